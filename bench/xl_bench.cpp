@@ -0,0 +1,808 @@
+// xl_bench: microbenchmarks for the xl write pipeline
+//
+// usage: xl_bench [filter], runs the benchmarks whose name contains the filter; the opt-in ones
+// (large scenarios) run only when named exactly
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <xl/deflate.hpp>
+#include <xl/fnv64.hpp>
+#include <xl/pack.hpp>
+#include <xl/writer.hpp>
+#include <xl/xml.hpp>
+
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+
+// keeps the optimizer from discarding benchmarked work
+volatile std::size_t sink = 0;
+
+void keep(std::size_t v) { sink = v; }
+
+// runs f repeatedly for at least min_time and returns the best time of a single run, in seconds
+template <typename F> auto measure(F&& f, double min_time = 0.5) -> double
+{
+    using clock = std::chrono::steady_clock;
+    auto best = 1e300;
+    auto total = 0.0;
+    do {
+        auto const t0 = clock::now();
+        f();
+        auto const dt = std::chrono::duration<double>(clock::now() - t0).count();
+        best = std::min(best, dt);
+        total += dt;
+    } while (total < min_time);
+    return best;
+}
+
+// prints the time and throughput of a benchmark, in cells per second too when cells are given
+void report(std::string_view name, double seconds, std::size_t bytes, std::size_t cells = 0)
+{
+    std::printf("%-40.*s %10.3f ms %10.1f MB/s", int(name.size()), name.data(), seconds * 1e3,
+        double(bytes) / seconds / 1e6);
+    if (cells)
+        std::printf(" %10.2f Mcells/s", double(cells) / seconds / 1e6);
+    std::printf("\n");
+}
+
+// returns the peak resident set size of the process so far, in bytes (0 when unknown)
+auto peak_rss() -> std::size_t
+{
+#if __has_include(<sys/resource.h>)
+    auto usage = rusage{};
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+#if defined(__APPLE__)
+        return std::size_t(usage.ru_maxrss);
+#else
+        return std::size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    return 0;
+}
+
+#if defined(__linux__)
+// returns a size reported in /proc/self/status (e.g. VmRSS, VmHWM), in bytes (0 when unknown)
+auto proc_status_size(std::string_view key) -> std::size_t
+{
+    auto in = std::ifstream{"/proc/self/status"};
+    for (auto line = std::string{}; std::getline(in, line);)
+        if (line.starts_with(key) && line.size() > key.size() && line[key.size()] == ':')
+            return std::size_t(std::stoull(line.substr(key.size() + 1))) * 1024;
+    return 0;
+}
+#endif
+
+// RSS of the process when the current scenario started, when its peak could be reset then
+std::optional<std::size_t> scenario_rss;
+
+// starts an end-to-end scenario, whose peak RSS report_scenario reports, and returns its start
+// time
+//
+// on Linux the peak RSS of the process is reset (/proc/self/clear_refs), so that the scenario is
+// not charged for the ones before it, after returning the memory they freed to the system (which
+// the scenario would otherwise reuse without raising the RSS); elsewhere the peak of the process
+// so far is reported
+auto start_scenario() -> std::chrono::steady_clock::time_point
+{
+    scenario_rss.reset();
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+#if defined(__linux__)
+    if (auto out = std::ofstream{"/proc/self/clear_refs"}; out && out << "5" << std::flush)
+        if (auto const rss = proc_status_size("VmRSS"))
+            scenario_rss = rss;
+#endif
+    return std::chrono::steady_clock::now();
+}
+
+// fails the benchmark being run, xl_bench then exits with an error
+void check(bool ok, std::string_view what)
+{
+    if (!ok)
+        throw std::runtime_error(std::string{what});
+}
+
+auto seconds_since(std::chrono::steady_clock::time_point t0) -> double
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// text resembling typical cell content: names, words, codes and numbers, with an occasional
+// character that needs escaping
+auto make_cell_texts(std::size_t count) -> std::vector<std::string>
+{
+    static char const* const words[] = {"Product", "Invoice", "Customer", "North", "Warehouse",
+        "delivered", "pending", "Smith", "Johnson", "Ltd.", "Inc.", "Q3", "sample", "order",
+        "description", "of", "the", "with", "and", "total"};
+    auto rng = std::mt19937{42};
+    auto texts = std::vector<std::string>{};
+    texts.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        auto s = std::string{};
+        auto const n = 1 + rng() % 8;
+        for (unsigned j = 0; j < n; ++j) {
+            if (j)
+                s += ' ';
+            s += words[rng() % std::size(words)];
+        }
+        if (rng() % 3 == 0)
+            s += " #" + std::to_string(rng() % 100000);
+        if (rng() % 50 == 0)
+            s += " & Sons";
+        texts.push_back(std::move(s));
+    }
+    return texts;
+}
+
+void bench_scramble_texts(std::string_view name, std::vector<std::string> const& texts)
+{
+    auto bytes = std::size_t{0};
+    for (auto const& s : texts)
+        bytes += s.size();
+
+    auto label = std::string{name};
+    report(label + "/scan/scalar", measure([&] {
+        for (auto const& s : texts) {
+            auto const p = xl::detail::find_xml_special_scalar(s.data(), s.data() + s.size());
+            keep(std::size_t(p - s.data()));
+        }
+    }),
+        bytes);
+
+    report(label + "/scan/vectorized", measure([&] {
+        for (auto const& s : texts) {
+            auto const p = xl::detail::find_xml_special(s.data(), s.data() + s.size());
+            keep(std::size_t(p - s.data()));
+        }
+    }),
+        bytes);
+
+    auto buf = std::string{};
+    buf.reserve(bytes * 2);
+    report(label + "/xw::scramble", measure([&] {
+        buf.clear();
+        auto w = xl::xw{buf};
+        for (auto const& s : texts)
+            w.scramble(s, false);
+        keep(buf.size());
+    }),
+        bytes);
+}
+
+void bench_scramble()
+{
+    auto const texts = make_cell_texts(200000);
+    bench_scramble_texts("scramble/cells", texts);
+
+    // free-text notes, a few hundred bytes each
+    auto notes = std::vector<std::string>(texts.size() / 20);
+    for (std::size_t i = 0; i < texts.size(); ++i)
+        notes[i % notes.size()] += texts[i] + ". ";
+    bench_scramble_texts("scramble/notes", notes);
+}
+
+void bench_node()
+{
+    constexpr auto count = 200000;
+    auto buf = std::string{};
+    auto bytes = std::size_t{0};
+    auto const t = measure([&] {
+        buf.clear();
+        auto w = xl::xw{buf};
+        for (auto i = 1; i <= count; ++i) {
+            auto const attrs = {xl::xw::attr{"r", xl::cell_ref{1 + i % 20, i}},
+                xl::xw::attr{"s", i % 7}, xl::xw::attr{"t", "n"}};
+            w.node("c", attrs, [&](xl::xw& w) {
+                w.node("v", {}, [&](xl::xw& w) { w.scramble("12345.678", false); });
+            });
+        }
+        bytes = buf.size();
+        keep(bytes);
+    });
+    report("node/c", t, bytes, count);
+}
+
+void bench_col_number_as_letters()
+{
+    auto bytes = std::size_t{0};
+    auto const t = measure([&] {
+        bytes = 0;
+        for (auto n = 1; n <= xl::max_columns; ++n)
+            bytes += xl::col_number_as_letters(n).size();
+        keep(bytes);
+    });
+    report("col_number_as_letters", t, bytes, xl::max_columns);
+}
+
+void bench_shared_string()
+{
+    // a million lookups over 100k distinct strings, hits mostly
+    auto const texts = make_cell_texts(100000);
+    auto rng = std::mt19937{7};
+    auto order = std::vector<std::size_t>(1000000);
+    auto bytes = std::size_t{0};
+    for (auto& i : order) {
+        i = rng() % texts.size();
+        bytes += texts[i].size();
+    }
+
+    report("writer::shared_string", measure([&] {
+        auto w = xl::writer{};
+        for (auto i : order)
+            keep(w.shared_string(texts[i]));
+    }),
+        bytes, order.size());
+}
+
+void bench_fnv64()
+{
+    auto rng = std::mt19937{5};
+    auto blob = std::vector<std::byte>(1 << 20);
+    for (auto& b : blob)
+        b = std::byte(rng());
+    report("fnv64/1MiB", measure([&] { keep(xl::fnv64(blob.data(), blob.size())); }),
+        blob.size());
+
+    auto const texts = make_cell_texts(100000);
+    auto bytes = std::size_t{0};
+    for (auto const& t : texts)
+        bytes += t.size();
+    report("fnv64/cell texts", measure([&] {
+        for (auto const& t : texts)
+            keep(xl::fnv64(t.data(), t.size()));
+    }),
+        bytes, texts.size());
+}
+
+// sheet XML for packing, about size bytes
+auto make_sheet_xml(std::size_t size) -> std::string
+{
+    auto rng = std::mt19937{11};
+    auto const texts = make_cell_texts(1000);
+    auto xml = std::string{};
+    auto w = xl::xw{xml};
+    for (auto row = 1; xml.size() < size; ++row)
+        w.node("row", {{"r", row}}, [&](xl::xw& w) {
+            for (auto col = 1; col <= 20; ++col)
+                w.node("c", {{"r", xl::cell_ref{col, row}}}, [&](xl::xw& w) {
+                    w.node("v", {}, [&](xl::xw& w) {
+                        if (col % 2)
+                            w.scramble(std::to_string(rng() % 1000000), false);
+                        else
+                            w.scramble(texts[rng() % texts.size()], false);
+                    });
+                });
+        });
+    return xml;
+}
+
+void bench_pack()
+{
+    auto files = std::map<std::string, xl::part>{};
+    auto bytes = std::size_t{0};
+    for (auto i = 1; i <= 4; ++i) {
+        auto xml = make_sheet_xml(std::size_t{8} << 20);
+        bytes += xml.size();
+        files["/xl/worksheets/sheet" + std::to_string(i) + ".xml"] = std::move(xml);
+    }
+
+    for (auto [name, options] : {
+             std::pair{"pack/normal", xl::pack_options{}},
+             std::pair{"pack/fast",
+                 xl::pack_options{.policy = [](auto, auto&) { return xl::compression::fast; }}},
+             std::pair{"pack/normal/threads", xl::pack_options{.threads = 0}},
+         }) {
+        auto out = std::vector<char>{};
+        report(name, measure([&] {
+            out.clear();
+            xl::pack(out, files, options);
+            keep(out.size());
+        }),
+            bytes);
+    }
+}
+
+// packs the archive of a written workbook into a sink that only counts it, and reports both
+// phases along with the peak RSS
+void report_scenario(std::string_view name, xl::writer& w, double t_write, std::size_t cells)
+{
+    auto xml_bytes = std::size_t{0};
+    for (auto const& [_, p] : w.files)
+        xml_bytes += p.content().size();
+
+    auto const t0 = std::chrono::steady_clock::now();
+    auto zip_bytes = std::size_t{0};
+    xl::pack([&](std::string_view chunk) { zip_bytes += chunk.size(); }, w.files);
+    auto const t_pack = seconds_since(t0);
+
+    auto label = std::string{name};
+    report(label + "/write", t_write, xml_bytes, cells);
+    report(label + "/pack", t_pack, xml_bytes, cells);
+    report(label + "/total", t_write + t_pack, zip_bytes, cells);
+#if defined(__linux__)
+    if (scenario_rss) {
+        auto const peak = proc_status_size("VmHWM");
+        std::printf("%-40s %10.1f MB peak RSS above the start\n", (label + "/memory").c_str(),
+            double(peak > *scenario_rss ? peak - *scenario_rss : 0) / 1e6);
+        return;
+    }
+#endif
+    std::printf("%-40s %10.1f MB peak RSS of the process\n", (label + "/memory").c_str(),
+        double(peak_rss()) / 1e6);
+}
+
+// end-to-end: streams the rows produced by make_row(row_number, row) into a sheet
+template <typename F>
+void run_scenario(std::string_view name, int rows, std::size_t cells_per_row, F&& make_row,
+    xl::string_mode strings = xl::string_mode::shared)
+{
+    auto const t0 = start_scenario();
+    auto w = xl::writer{};
+    auto r = xl::row{};
+    auto s = w.open_sheet("sheet1", {}, strings);
+    for (auto i = 1; i <= rows; ++i) {
+        make_row(i, r);
+        s.append(r);
+    }
+    s.close();
+    w.finish("xl_bench");
+    report_scenario(name, w, seconds_since(t0), std::size_t(rows) * cells_per_row);
+}
+
+void bench_e2e_numeric()
+{
+    auto rng = std::mt19937{1};
+    run_scenario("e2e/numeric 1Mx20", 1000000, 20, [&](int, xl::row& r) {
+        r.cells.resize(20);
+        for (auto& c : r.cells)
+            c.data = float(rng() % 10000000) / 100.0f;
+    });
+}
+
+void bench_e2e_columnar()
+{
+    // the same table as e2e/numeric, from a columnar sheet
+    auto rng = std::mt19937{1};
+    auto sh = xl::columnar_sheet{.name = "sheet1", .rows = 1000000, .columns = {}, .widths = {}};
+    sh.columns.resize(20);
+    for (auto& c : sh.columns) {
+        auto values = std::vector<double>(sh.rows);
+        for (auto& v : values)
+            v = double(rng() % 10000000) / 100.0;
+        c.values = std::move(values);
+    }
+
+    auto const t0 = start_scenario();
+    auto w = xl::writer{};
+    w.write_sheet(sh);
+    w.finish("xl_bench");
+    report_scenario("e2e/columnar 1Mx20", w, seconds_since(t0), sh.rows * sh.columns.size());
+}
+
+void bench_e2e_strings()
+{
+    // about four million distinct values, as shared strings and then inline
+    for (auto strings : {xl::string_mode::shared, xl::string_mode::automatic}) {
+        auto rng = std::mt19937{2};
+        auto const name = strings == xl::string_mode::shared ? "e2e/strings 1Mx20"
+                                                             : "e2e/strings/automatic 1Mx20";
+        run_scenario(
+            name, 1000000, 20,
+            [&](int, xl::row& r) {
+                r.cells.resize(20);
+                for (auto& c : r.cells)
+                    c.data.emplace<std::pmr::string>("customer ") +=
+                        std::to_string(rng() % 4000000);
+            },
+            strings);
+    }
+}
+
+void bench_e2e_labels()
+{
+    // 100 category labels, as strings and as ids registered beforehand
+    auto labels = std::vector<std::pmr::string>{};
+    for (auto i = 0; i < 100; ++i)
+        labels.emplace_back("category " + std::to_string(i));
+
+    auto rng = std::mt19937{5};
+    run_scenario("e2e/labels 1Mx20", 1000000, 20, [&](int, xl::row& r) {
+        r.cells.resize(20);
+        for (auto& c : r.cells)
+            c.data = labels[rng() % labels.size()];
+    });
+
+    rng = std::mt19937{5};
+    auto const t0 = start_scenario();
+    auto w = xl::writer{};
+    auto ids = std::vector<xl::shared_string_id>{};
+    for (auto const& label : labels)
+        ids.push_back(w.string_id(label));
+    auto r = xl::row{};
+    r.cells.resize(20);
+    auto s = w.open_sheet("sheet1");
+    for (auto i = 0; i < 1000000; ++i) {
+        for (auto& c : r.cells)
+            c.data = ids[rng() % ids.size()];
+        s.append(r);
+    }
+    s.close();
+    w.finish("xl_bench");
+    report_scenario("e2e/labels/ids 1Mx20", w, seconds_since(t0), std::size_t(20000000));
+}
+
+void bench_e2e_styles()
+{
+    auto const texts = make_cell_texts(10000);
+    auto const xfs = std::vector<xl::xf>{{}, {{"center", ""}}, {{"left", "top"}},
+        {{"right", "bottom"}}, {{"", "center"}}};
+    auto rng = std::mt19937{3};
+    run_scenario("e2e/mixed+styles 1Mx20", 1000000, 20, [&](int, xl::row& r) {
+        r.cells.resize(20);
+        for (std::size_t i = 0; i < r.cells.size(); ++i) {
+            auto& c = r.cells[i];
+            switch (i % 4) {
+            case 0: c.data = std::pmr::string{texts[rng() % texts.size()]}; break;
+            case 1: c.data = float(rng() % 100000) / 10.0f; break;
+            case 2: c.data = rng() % 2 == 0; break;
+            default: c.data = std::monostate{};
+            }
+            c.xf = xfs[rng() % xfs.size()];
+        }
+    });
+}
+
+void bench_e2e_pictures()
+{
+    // 10k distinct 16 KiB images, the media parts refer to the pictures of the cells
+    auto rng = std::mt19937{4};
+    auto wb = xl::workbook{};
+    wb.app_name = "xl_bench";
+    auto& sh = wb.sheets.emplace_back();
+    sh.name = "sheet1";
+    auto& rows = sh.rows;
+    rows.resize(10000);
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        auto pic = xl::cell_picture{
+            .ext = ".png", .blob = std::vector<std::byte>(16 << 10), .shared_blob = {}};
+        for (auto& b : pic.blob)
+            b = std::byte(rng());
+        rows[i].cells.emplace_back(xl::cell_data{std::pmr::string{"picture " + std::to_string(i)}});
+        rows[i].cells.emplace_back(xl::cell_data{std::move(pic)});
+    }
+
+    auto const t0 = start_scenario();
+    auto w = xl::writer{};
+    w.write(wb);
+    report_scenario("e2e/pictures 10k", w, seconds_since(t0), rows.size() * 2);
+}
+
+// writes and packs a small report (one sheet of 20x5 cells) over and over, where the fixed cost
+// of the package parts dominates
+void bench_small_workbook()
+{
+    auto wb = xl::workbook{};
+    wb.app_name = "xl_bench";
+    auto& sh = wb.sheets.emplace_back();
+    sh.name = "report";
+    for (auto i = 0; i < 20; ++i) {
+        auto& r = sh.rows.emplace_back();
+        r.cells.emplace_back(xl::cell_data{std::pmr::string{"item " + std::to_string(i)}});
+        for (auto j = 0; j < 4; ++j)
+            r.cells.emplace_back(xl::cell_data{double(i * 4 + j) / 8});
+        r.cells.front().xf.alignment.horizontal = "left";
+    }
+
+    for (auto [name, packed] :
+        {std::pair{"small/write", false}, std::pair{"small/write+pack", true}}) {
+        auto bytes = std::size_t{0};
+        auto const t = measure([&] {
+            auto w = xl::writer{};
+            w.write(wb);
+            bytes = 0;
+            if (packed)
+                xl::pack([&](std::string_view chunk) { bytes += chunk.size(); }, w.files);
+            else
+                for (auto const& [_, p] : w.files)
+                    bytes += p.content().size();
+        });
+        std::printf("%-40s %10.3f us %10.0f workbooks/s\n", name, t * 1e6, 1 / t);
+        keep(bytes);
+    }
+
+    // the same writer for every workbook, see writer::reset
+    auto w = xl::writer{};
+    auto const t = measure([&] {
+        w.reset();
+        w.write(wb);
+        keep(w.files.size());
+    });
+    std::printf("%-40s %10.3f us %10.0f workbooks/s\n", "small/write/reset", t * 1e6, 1 / t);
+}
+
+// builds and destroys a workbook of 200k rows of 20 text cells, with the default memory resource
+// and with a monotonic buffer resource that releases the whole model at once
+void bench_model()
+{
+    using clock = std::chrono::steady_clock;
+    constexpr auto rows = std::size_t{200000};
+    constexpr auto columns = std::size_t{20};
+    auto const texts = make_cell_texts(10000);
+
+    auto run = [&](std::string_view name, bool monotonic) {
+        auto build = 1e300;
+        auto teardown = 1e300;
+        auto bytes = std::size_t{0};
+        for (auto n = 0; n < 3; ++n) {
+            auto const t0 = clock::now();
+            auto buffer = std::optional<std::pmr::monotonic_buffer_resource>{};
+            if (monotonic)
+                buffer.emplace();
+            auto wb = std::optional<xl::workbook>{
+                std::in_place, monotonic ? &*buffer : std::pmr::get_default_resource()};
+            auto& sh = wb->sheets.emplace_back();
+            sh.name = "sheet1";
+            sh.rows.resize(rows);
+            bytes = 0;
+            for (std::size_t i = 0; i < rows; ++i) {
+                auto& r = sh.rows[i];
+                r.cells.resize(columns);
+                for (std::size_t j = 0; j < columns; ++j) {
+                    auto const& text = texts[(i * columns + j) % texts.size()];
+                    r.cells[j].data.emplace<std::pmr::string>(text, r.cells.get_allocator());
+                    bytes += text.size();
+                }
+            }
+            auto const t1 = clock::now();
+            wb.reset();
+            buffer.reset();
+            auto const t2 = clock::now();
+            build = std::min(build, std::chrono::duration<double>(t1 - t0).count());
+            teardown = std::min(teardown, std::chrono::duration<double>(t2 - t1).count());
+        }
+        auto label = std::string{name};
+        report(label + "/build", build, bytes, rows * columns);
+        report(label + "/teardown", teardown, bytes, rows * columns);
+    };
+    run("model/default 200kx20", false);
+    run("model/monotonic 200kx20", true);
+}
+
+// streams 1k pictures to a sheet, whose rows are gone by the time the media parts are checked and
+// the archive is packed
+void bench_e2e_pictures_streamed()
+{
+    constexpr auto count = std::size_t{1000};
+    auto make_picture = [](std::size_t i) {
+        auto pic = xl::cell_picture{
+            .ext = ".png", .blob = std::vector<std::byte>(4 << 10), .shared_blob = {}};
+        auto rng = std::mt19937{unsigned(i)};
+        for (auto& b : pic.blob)
+            b = std::byte(rng());
+        return pic;
+    };
+
+    auto const t0 = start_scenario();
+    auto w = xl::writer{};
+    auto s = w.open_sheet("sheet1");
+    for (std::size_t i = 0; i < count; ++i) {
+        auto r = xl::row{};
+        r.cells.emplace_back(xl::cell_data{make_picture(i)});
+        s.append(r);
+    }
+    s.close();
+    w.finish("xl_bench");
+    auto const t_write = seconds_since(t0);
+
+    check(w.media.size() == count, "e2e/pictures/streamed: missing media parts");
+    for (auto const& m : w.media) {
+        auto const expected = make_picture(m.iid).blob;
+        check(w.files["/xl/media/" + m.name].content() ==
+                  std::string_view{reinterpret_cast<char const*>(expected.data()), expected.size()},
+            "e2e/pictures/streamed: media part differs from the picture");
+    }
+    report_scenario("e2e/pictures/streamed 1k", w, t_write, count);
+}
+
+#ifdef XL_BENCH_MINIZ_READER
+// reads an entry of a zip archive on disk back with miniz, returns its size and crc-32
+auto read_back(std::filesystem::path const& path, char const* name)
+    -> std::pair<std::uint64_t, std::uint32_t>
+{
+    struct result {
+        std::uint64_t size = 0;
+        std::uint32_t crc = MZ_CRC32_INIT;
+    } r;
+    mz_zip_archive archive;
+    memset(&archive, 0, sizeof(archive));
+    auto const ok = mz_zip_reader_init_file(&archive, path.string().c_str(), 0) &&
+                    mz_zip_reader_extract_file_to_callback(&archive, name,
+                        [](void* user, mz_uint64, void const* buf, std::size_t n) -> std::size_t {
+                            auto& r = *static_cast<result*>(user);
+                            r.size += n;
+                            r.crc = std::uint32_t(
+                                mz_crc32(r.crc, static_cast<mz_uint8 const*>(buf), n));
+                            return n;
+                        },
+                        &r, 0);
+    mz_zip_reader_end(&archive);
+    check(ok, std::string{"failed to read back "} + name);
+    return {r.size, r.crc};
+}
+#endif
+
+// streams a sheet of more than 4 GiB of XML through the deflate encoder into a zip64 archive on
+// disk, then reads the sheet back and checks its size and crc
+//
+// the rows are wide enough for the sheet to stay within the row limit of Excel
+void bench_zip64()
+{
+    using clock = std::chrono::steady_clock;
+    constexpr auto target = std::uint64_t{9} << 29; // 4.5 GiB
+    constexpr auto max_rows = 1048576;
+
+    auto written = std::uint64_t{0};
+    auto w = xl::writer{};
+    w.sheet_encoder = [&] {
+        auto e = xl::deflate_encoder(MZ_BEST_SPEED);
+        return xl::part_encoder{
+            .write =
+                [&, e](std::string_view chunk) {
+                    written += chunk.size();
+                    e.write(chunk);
+                },
+            .finish = e.finish,
+        };
+    };
+
+    auto r = xl::row{};
+    auto const texts = make_cell_texts(20);
+    for (auto i = 0; i < 256; ++i)
+        if (i % 2)
+            r.cells.push_back(xl::cell_data{std::pmr::string{texts[std::size_t(i % 20)]}});
+        else
+            r.cells.push_back(xl::cell_data{float(i) * 1.25f});
+
+    auto const t0 = clock::now();
+    auto s = w.open_sheet("sheet1");
+    auto rows = 0;
+    for (; written < target; ++rows)
+        s.append(r);
+    s.close();
+    w.finish("xl_bench");
+    auto const sheet = w.files["/xl/worksheets/sheet1.xml"];
+    auto const t1 = clock::now();
+    check(rows <= max_rows, "zip64: too many rows for a sheet");
+    check(sheet.size > 0xFFFFFFFF, "zip64: the sheet is smaller than 4 GiB");
+
+    auto const path = std::filesystem::temp_directory_path() / "xl_bench_zip64.xlsx";
+    xl::pack(path, w.files);
+    auto const t2 = clock::now();
+
+    report("zip64/serialize+deflate", std::chrono::duration<double>(t1 - t0).count(), sheet.size);
+    report("zip64/pack", std::chrono::duration<double>(t2 - t1).count(),
+        std::filesystem::file_size(path));
+
+#ifdef XL_BENCH_MINIZ_READER
+    auto const [size, crc] = read_back(path, "xl/worksheets/sheet1.xml");
+    check(size == sheet.size && crc == sheet.crc, "zip64: the sheet read back differs");
+    std::printf("zip64/read back: ok (%llu bytes)\n", static_cast<unsigned long long>(size));
+#endif
+
+    std::filesystem::remove(path);
+}
+
+// packs incompressible media stored as is into an archive of more than 4 GiB, which has to be
+// written in the zip64 format from the start, then reads the media back
+//
+// the media are overlapping views of a single buffer, so that they differ without taking 4 GiB
+// of memory
+void bench_zip64_stored()
+{
+    using clock = std::chrono::steady_clock;
+    constexpr auto count = std::size_t{9};
+    constexpr auto size = std::size_t{480} << 20;
+    constexpr auto shift = std::size_t{4096};
+
+    auto noise = std::vector<std::uint64_t>((size + count * shift) / sizeof(std::uint64_t));
+    auto rng = std::mt19937_64{3};
+    for (auto& v : noise)
+        v = rng();
+    auto const bytes = std::as_bytes(std::span{noise});
+
+    auto w = xl::writer{};
+    w.finish("xl_bench");
+    auto names = std::vector<std::string>{};
+    for (std::size_t i = 0; i < count; ++i) {
+        names.push_back("xl/media/noise" + std::to_string(i + 1) + ".png");
+        w.files["/" + names.back()] = xl::part{bytes.subspan(i * shift, size)};
+    }
+
+    auto const path = std::filesystem::temp_directory_path() / "xl_bench_zip64_stored.xlsx";
+    auto const t0 = clock::now();
+    xl::pack(path, w.files);
+    auto const t1 = clock::now();
+    auto const archive_size = std::filesystem::file_size(path);
+    report("zip64/stored/pack", std::chrono::duration<double>(t1 - t0).count(), archive_size);
+    check(archive_size > 0xFFFFFFFF, "zip64/stored: the archive is smaller than 4 GiB");
+
+#ifdef XL_BENCH_MINIZ_READER
+    for (std::size_t i = 0; i < count; ++i) {
+        auto const media = bytes.subspan(i * shift, size);
+        auto const expected = std::uint32_t(mz_crc32(MZ_CRC32_INIT,
+            reinterpret_cast<mz_uint8 const*>(media.data()), media.size()));
+        auto const [n, crc] = read_back(path, names[i].c_str());
+        check(n == size && crc == expected, "zip64/stored: a media part read back differs");
+    }
+    std::printf("zip64/stored/read back: ok (%zu media)\n", count);
+#endif
+
+    std::filesystem::remove(path);
+}
+
+struct benchmark {
+    std::string_view name;
+    void (*run)();
+    bool opt_in = false;
+};
+
+benchmark const benchmarks[] = {
+    {"scramble", bench_scramble},
+    {"node", bench_node},
+    {"col_number_as_letters", bench_col_number_as_letters},
+    {"shared_string", bench_shared_string},
+    {"fnv64", bench_fnv64},
+    {"pack", bench_pack},
+    {"e2e/numeric", bench_e2e_numeric},
+    {"e2e/columnar", bench_e2e_columnar},
+    {"e2e/strings", bench_e2e_strings},
+    {"e2e/labels", bench_e2e_labels},
+    {"e2e/mixed+styles", bench_e2e_styles},
+    {"e2e/pictures", bench_e2e_pictures},
+    {"e2e/pictures/streamed", bench_e2e_pictures_streamed},
+    {"small", bench_small_workbook},
+    {"model", bench_model},
+    {"zip64", bench_zip64, true},
+    {"zip64/stored", bench_zip64_stored, true},
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    auto const filter = std::string_view{argc > 1 ? argv[1] : ""};
+    auto failed = false;
+    for (auto const& b : benchmarks)
+        if (b.opt_in ? b.name == filter : b.name.find(filter) != std::string_view::npos) {
+            try {
+                b.run();
+            }
+            catch (std::exception const& e) {
+                std::fprintf(stderr, "%.*s failed: %s\n", int(b.name.size()), b.name.data(),
+                    e.what());
+                failed = true;
+            }
+        }
+    return failed ? 1 : 0;
+}
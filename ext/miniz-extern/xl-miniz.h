@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <ctime>
 
 extern "C" {
 
@@ -12,6 +14,47 @@ typedef unsigned int mz_uint;
 typedef int64_t mz_int64;
 typedef uint64_t mz_uint64;
 typedef int mz_bool;
+typedef unsigned long mz_ulong;
+
+#define MZ_FALSE (0)
+#define MZ_TRUE (1)
+
+#define MZ_CRC32_INIT (0)
+#define MZ_DEFAULT_WINDOW_BITS 15
+
+enum { MZ_DEFAULT_STRATEGY = 0 };
+
+enum {
+    MZ_NO_COMPRESSION = 0,
+    MZ_BEST_SPEED = 1,
+    MZ_BEST_COMPRESSION = 9,
+    MZ_UBER_COMPRESSION = 10,
+    MZ_DEFAULT_LEVEL = 6,
+    MZ_DEFAULT_COMPRESSION = -1
+};
+
+typedef enum {
+    MZ_ZIP_FLAG_COMPRESSED_DATA = 0x0400,
+    MZ_ZIP_FLAG_WRITE_ZIP64 = 0x4000
+} mz_zip_flags;
+
+typedef struct tdefl_compressor tdefl_compressor;
+
+typedef mz_bool (*tdefl_put_buf_func_ptr)(const void* pBuf, int len, void* pUser);
+
+typedef enum {
+    TDEFL_STATUS_BAD_PARAM = -2,
+    TDEFL_STATUS_PUT_BUF_FAILED = -1,
+    TDEFL_STATUS_OKAY = 0,
+    TDEFL_STATUS_DONE = 1
+} tdefl_status;
+
+typedef enum {
+    TDEFL_NO_FLUSH = 0,
+    TDEFL_SYNC_FLUSH = 2,
+    TDEFL_FULL_FLUSH = 3,
+    TDEFL_FINISH = 4
+} tdefl_flush;
 
 typedef enum {
     MZ_ZIP_MODE_INVALID = 0,
@@ -103,12 +146,36 @@ typedef struct {
 
 } mz_zip_archive;
 
+extern mz_ulong mz_crc32(mz_ulong crc, const unsigned char* ptr, size_t buf_len);
+
+extern tdefl_compressor* tdefl_compressor_alloc(void);
+
+extern void tdefl_compressor_free(tdefl_compressor* pComp);
+
+extern tdefl_status tdefl_init(
+    tdefl_compressor* d, tdefl_put_buf_func_ptr pPut_buf_func, void* pPut_buf_user, int flags);
+
+extern tdefl_status tdefl_compress_buffer(
+    tdefl_compressor* d, const void* pIn_buf, size_t in_buf_size, tdefl_flush flush);
+
+extern mz_uint tdefl_create_comp_flags_from_zip_params(int level, int window_bits, int strategy);
+
+extern mz_bool mz_zip_writer_init_v2(mz_zip_archive* pZip, mz_uint64 existing_size, mz_uint flags);
+
 extern mz_bool mz_zip_writer_init_heap_v2(mz_zip_archive* pZip, size_t size_to_reserve_at_beginning,
     size_t initial_allocation_size, mz_uint flags);
 
 extern mz_bool mz_zip_writer_add_mem(mz_zip_archive* pZip, const char* pArchive_name,
     const void* pBuf, size_t buf_size, mz_uint level_and_flags);
 
+extern mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive* pZip, const char* pArchive_name,
+    const void* pBuf, size_t buf_size, const void* pComment, mz_uint16 comment_size,
+    mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t* last_modified,
+    const char* user_extra_data_local, mz_uint user_extra_data_local_len,
+    const char* user_extra_data_central, mz_uint user_extra_data_central_len);
+
+extern mz_bool mz_zip_writer_finalize_archive(mz_zip_archive* pZip);
+
 extern mz_bool mz_zip_writer_finalize_heap_archive(
     mz_zip_archive* pZip, void** ppBuf, size_t* pSize);
 
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include <xl-miniz.h>
+#include <xl/parallel.hpp>
+#include <xl/part.hpp>
+
+namespace xl {
+
+namespace detail {
+
+struct deflate_state {
+    tdefl_compressor* compressor = nullptr;
+    part result;
+
+    ~deflate_state() { tdefl_compressor_free(compressor); }
+};
+
+inline auto deflate_put(void const* buf, int len, void* user) -> mz_bool
+{
+    static_cast<std::string*>(user)->append(static_cast<char const*>(buf), std::size_t(len));
+    return MZ_TRUE;
+}
+
+inline void init_deflate(deflate_state& st, int level)
+{
+    st.compressor = tdefl_compressor_alloc();
+    if (!st.compressor)
+        throw std::bad_alloc();
+
+    st.result.deflated = true;
+    st.result.crc = MZ_CRC32_INIT;
+
+    auto const flags = tdefl_create_comp_flags_from_zip_params(
+        level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    if (tdefl_init(st.compressor, deflate_put, &st.result.data, int(flags)) != TDEFL_STATUS_OKAY)
+        throw std::runtime_error("failed to initialize deflate compressor");
+}
+
+// compresses a chunk of content, the chunks are independent of each other and all but the last
+// end on a byte boundary without the final block flag (sync flush), so that their concatenation
+// is a single valid deflate stream
+inline auto deflate_chunk(std::string_view content, int level, bool last) -> part
+{
+    auto st = deflate_state{};
+    init_deflate(st, level);
+
+    st.result.size = content.size();
+    st.result.crc = std::uint32_t(mz_crc32(
+        MZ_CRC32_INIT, reinterpret_cast<mz_uint8 const*>(content.data()), content.size()));
+    auto const flush = last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH;
+    auto const done = last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY;
+    if (tdefl_compress_buffer(st.compressor, content.data(), content.size(), flush) != done)
+        throw std::runtime_error("failed to compress part content");
+    return std::move(st.result);
+}
+
+// multiplies a 32x32 matrix over GF(2) by a vector
+inline auto gf2_times(std::array<std::uint32_t, 32> const& m, std::uint32_t v) -> std::uint32_t
+{
+    auto sum = std::uint32_t{0};
+    for (auto i = 0; v; v >>= 1, ++i)
+        if (v & 1)
+            sum ^= m[i];
+    return sum;
+}
+
+inline void gf2_square(std::array<std::uint32_t, 32>& sq, std::array<std::uint32_t, 32> const& m)
+{
+    for (auto i = 0; i < 32; ++i)
+        sq[i] = gf2_times(m, m[i]);
+}
+
+// returns the crc-32 of two concatenated blocks from their crc-32s and the size of the second
+// (zlib's crc32_combine), applying the crc of size zero bytes to the first by repeated squaring
+inline auto crc32_combine(std::uint32_t crc1, std::uint32_t crc2, std::uint64_t size2)
+    -> std::uint32_t
+{
+    if (!size2)
+        return crc1;
+
+    auto even = std::array<std::uint32_t, 32>{}; // even powers of two zero bits
+    auto odd = std::array<std::uint32_t, 32>{};  // odd powers of two zero bits
+
+    odd[0] = 0xedb88320; // crc-32 polynomial
+    for (auto i = 1; i < 32; ++i)
+        odd[i] = std::uint32_t{1} << (i - 1);
+
+    gf2_square(even, odd); // two zero bits
+    gf2_square(odd, even); // four zero bits
+
+    // the first squaring gives a zero byte
+    do {
+        gf2_square(even, odd);
+        if (size2 & 1)
+            crc1 = gf2_times(even, crc1);
+        size2 >>= 1;
+        if (!size2)
+            break;
+
+        gf2_square(odd, even);
+        if (size2 & 1)
+            crc1 = gf2_times(odd, crc1);
+        size2 >>= 1;
+    } while (size2);
+
+    return crc1 ^ crc2;
+}
+
+// joins the chunks produced by deflate_chunk into a single part
+inline auto join_chunks(std::span<part> chunks) -> part
+{
+    if (chunks.size() == 1)
+        return std::move(chunks.front());
+
+    auto result = part{};
+    result.deflated = true;
+
+    auto total = std::size_t{0};
+    for (auto const& c : chunks)
+        total += c.data.size();
+    result.data.reserve(total);
+
+    for (auto& c : chunks) {
+        result.data += c.data;
+        result.crc = crc32_combine(result.crc, c.crc, c.size);
+        result.size += c.size;
+        c = {};
+    }
+    return result;
+}
+
+} // namespace detail
+
+// creates an encoder that compresses part content into a raw deflate stream as it arrives, so
+// that only the compressed form is ever kept in memory
+//
+// the produced parts are stored into the archive by xl::pack as is, without recompression
+inline auto deflate_encoder(int level = MZ_DEFAULT_LEVEL) -> part_encoder
+{
+    auto st = std::make_shared<detail::deflate_state>();
+    detail::init_deflate(*st, level);
+
+    return part_encoder{
+        .write =
+            [st](std::string_view chunk) {
+                st->result.size += chunk.size();
+                st->result.crc = std::uint32_t(mz_crc32(st->result.crc,
+                    reinterpret_cast<mz_uint8 const*>(chunk.data()), chunk.size()));
+                if (tdefl_compress_buffer(st->compressor, chunk.data(), chunk.size(),
+                        TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY)
+                    throw std::runtime_error("failed to compress part content");
+            },
+        .finish =
+            [st]() {
+                if (tdefl_compress_buffer(st->compressor, nullptr, 0, TDEFL_FINISH) !=
+                    TDEFL_STATUS_DONE)
+                    throw std::runtime_error("failed to compress part content");
+                return std::move(st->result);
+            },
+    };
+}
+
+// compresses the given content into a part at once
+inline auto deflate(std::string_view content, int level = MZ_DEFAULT_LEVEL) -> part
+{
+    return detail::deflate_chunk(content, level, true);
+}
+
+// compresses the given content into a part on the given number of threads (0 meaning one per
+// hardware thread), in independent chunks of chunk_size bytes (which must not be 0)
+//
+// each chunk starts with an empty window, which costs a little compression at the start of every
+// chunk; the output depends on the chunk size only, not on the number of threads
+inline auto deflate(std::string_view content, int level, std::size_t threads,
+    std::size_t chunk_size = std::size_t{1} << 20) -> part
+{
+    if (chunk_size == 0)
+        throw std::invalid_argument("chunk size must not be 0");
+    auto const count = std::max<std::size_t>(1, (content.size() + chunk_size - 1) / chunk_size);
+    auto chunks = std::vector<part>(count);
+    detail::parallel_for(count, threads, [&](std::size_t i) {
+        chunks[i] = detail::deflate_chunk(content.substr(i * chunk_size, chunk_size), level,
+            i + 1 == count);
+    });
+    return detail::join_chunks(chunks);
+}
+
+} // namespace xl
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace xl {
+
+static constexpr auto max_columns = 16384; // XFD
+
+// 1-based cell coordinates, formatted as an A1-style reference
+struct cell_ref {
+    int col;
+    int row;
+};
+
+namespace detail {
+
+inline constexpr char digit_pairs[] = "00010203040506070809"
+                                      "10111213141516171819"
+                                      "20212223242526272829"
+                                      "30313233343536373839"
+                                      "40414243444546474849"
+                                      "50515253545556575859"
+                                      "60616263646566676869"
+                                      "70717273747576777879"
+                                      "80818283848586878889"
+                                      "90919293949596979899";
+
+// column letters for every column number, the last byte holds the number of letters
+using column_letters = std::array<char, 4>;
+
+constexpr auto make_column_letters() -> std::array<column_letters, max_columns + 1>
+{
+    auto table = std::array<column_letters, max_columns + 1>{};
+    for (int n = 1; n <= max_columns; ++n) {
+        char s[3] = {};
+        auto len = 0;
+        for (auto v = n; v > 0; v = (v - 1) / 26)
+            s[len++] = char('A' + (v - 1) % 26);
+        auto& e = table[std::size_t(n)];
+        for (auto i = 0; i < len; ++i)
+            e[std::size_t(i)] = s[len - 1 - i];
+        e[3] = char(len);
+    }
+    return table;
+}
+
+inline constexpr auto column_letter_table = make_column_letters();
+
+} // namespace detail
+
+// formats v as decimal digits at out, returns the end of the written digits
+//
+// out must have room for 20 characters
+inline auto format_uint(char* out, std::uint64_t v) -> char*
+{
+    char buf[20];
+    auto p = buf + sizeof(buf);
+    while (v >= 100) {
+        auto const i = std::size_t(v % 100) * 2;
+        v /= 100;
+        p -= 2;
+        std::memcpy(p, detail::digit_pairs + i, 2);
+    }
+    if (v >= 10) {
+        p -= 2;
+        std::memcpy(p, detail::digit_pairs + std::size_t(v) * 2, 2);
+    }
+    else
+        *--p = char('0' + v);
+
+    auto const n = std::size_t(buf + sizeof(buf) - p);
+    std::memcpy(out, p, n);
+    return out + n;
+}
+
+// writes the decimal digits of v, with a leading minus sign when negative
+inline auto format_int(char* out, std::int64_t v) -> char*
+{
+    if (v < 0) {
+        *out++ = '-';
+        return format_uint(out, 0 - std::uint64_t(v));
+    }
+    return format_uint(out, std::uint64_t(v));
+}
+
+// returns the letters of a column number in [1, max_columns]
+inline auto column_letters(int col) -> std::string_view
+{
+    auto const& e = detail::column_letter_table[std::size_t(col)];
+    return {e.data(), std::size_t(e[3])};
+}
+
+// formats an A1-style reference at out, returns the end of the written characters
+//
+// out must have room for 23 characters, the column must be in [1, max_columns]
+inline auto format_cell_ref(char* out, cell_ref ref) -> char*
+{
+    auto const& e = detail::column_letter_table[std::size_t(ref.col)];
+    std::memcpy(out, e.data(), 3);
+    return format_uint(out + e[3], std::uint32_t(ref.row));
+}
+
+} // namespace xl
@@ -1,44 +1,61 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace xl {
 
-struct sheet;
-struct row;
-struct cell;
-struct column;
+// the model types are allocator-aware: containers created with a std::pmr memory resource (e.g.
+// a workbook built in a std::pmr::monotonic_buffer_resource) pass it on to the sheets, rows,
+// cells and cell strings constructed in them, so a whole model can be released at once
+//
+// cell formats (xf), pictures and columnar sheets are not allocator-aware, their strings and
+// vectors always use the default allocator
 
-struct workbook {
-    std::string app_name;
-    std::vector<sheet> sheets;
-};
-
-struct sheet {
-    std::string name;
-    std::vector<row> rows;
-    std::map<int, column> columns;
-};
+// how the string cells of a sheet or column are written: as indices into the shared string table,
+// inline in the sheet (t="inlineStr", for values that rarely repeat, like ids or notes), or either
+// of these, chosen from how often the first strings of each column repeat
+enum class string_mode { shared, inline_string, automatic };
 
 struct column {
     int width = 0;
+    std::optional<string_mode> strings; // overrides the mode of the sheet
 };
 
-struct row {
-    std::vector<cell> cells;
-    int height = 0;
-};
-
+// the media part of a picture written from a sheet or workbook model refers to blob until the
+// archive is packed, one written to a streamed sheet gets a copy of it; shared_blob, when set, is
+// used instead of blob and is never copied, the media part keeps it alive
 struct cell_picture {
     std::string ext;
     std::vector<std::byte> blob;
+    std::shared_ptr<std::vector<std::byte> const> shared_blob;
+
+    auto bytes() const -> std::span<std::byte const>
+    {
+        if (shared_blob)
+            return *shared_blob;
+        return blob;
+    }
 };
 
-using cell_data = std::variant<std::monostate, bool, float, std::string, cell_picture>;
+// index of a string registered with writer::shared_string (or writer::string_id) beforehand; a
+// cell holding one is written as that shared string without looking the string up
+struct shared_string_id {
+    std::uint32_t index = 0;
+};
+
+using cell_data = std::variant<std::monostate, bool, float, std::pmr::string, cell_picture, double,
+    std::int64_t, shared_string_id>;
 
 struct alignment {
     std::string horizontal;
@@ -49,9 +66,42 @@ struct xf {
     xl::alignment alignment;
 };
 
+// sheet stored by columns, for exporting large uniform tables without building a cell per value
+//
+// every column holds one value per row in a contiguous vector of its type, strings as ids
+// registered with writer::shared_string beforehand; the cells marked in nulls are left empty
+struct columnar_sheet {
+    using values_type = std::variant<std::vector<double>, std::vector<std::int64_t>,
+        std::vector<bool>, std::vector<shared_string_id>>;
+
+    struct column {
+        values_type values;
+        std::vector<std::uint64_t> nulls;  // bit i set when the cell of row i is empty
+        std::vector<std::uint32_t> styles; // style (writer::style) of every row, or empty
+        std::size_t style = 0;             // style of all the rows when styles is empty
+
+        auto is_null(std::size_t row) const -> bool
+        {
+            return row / 64 < nulls.size() && (nulls[row / 64] >> (row % 64) & 1);
+        }
+        auto style_of(std::size_t row) const -> std::size_t
+        {
+            return styles.empty() ? style : styles[row];
+        }
+    };
+
+    std::string name;
+    std::size_t rows = 0;
+    std::vector<column> columns;
+    std::map<int, xl::column> widths;
+};
+
 struct cell {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     cell_data data;
     xl::xf xf;
+    std::size_t style = 0; // index returned by writer::style(), when set it is used instead of xf
     cell() {}
     cell(cell const&) = default;
     cell(cell&&) = default;
@@ -63,6 +113,154 @@ struct cell {
         : data{std::move(v)}
     {
     }
+    // string values, which cell_data only takes as std::pmr::string
+    cell(char const* s, allocator_type a = {})
+        : data{std::in_place_type<std::pmr::string>, s, a}
+    {
+    }
+    cell(std::string_view s, allocator_type a = {})
+        : data{std::in_place_type<std::pmr::string>, s, a}
+    {
+    }
+    cell(std::string const& s, allocator_type a = {})
+        : data{std::in_place_type<std::pmr::string>, s, a}
+    {
+    }
+
+    explicit cell(allocator_type) {}
+    cell(cell const& c, allocator_type a)
+        : data{with_allocator(c.data, a)}
+        , xf{c.xf}
+        , style{c.style}
+    {
+    }
+    cell(cell&& c, allocator_type a)
+        : data{with_allocator(std::move(c.data), a)}
+        , xf{std::move(c.xf)}
+        , style{c.style}
+    {
+    }
+    cell(cell_data const& v, allocator_type a)
+        : data{with_allocator(v, a)}
+    {
+    }
+    cell(cell_data&& v, allocator_type a)
+        : data{with_allocator(std::move(v), a)}
+    {
+    }
+
+    auto operator=(cell const&) -> cell& = default;
+    auto operator=(cell&&) -> cell& = default;
+
+    // copies or moves a value, a string value is put in memory of the given allocator
+    static auto with_allocator(cell_data const& v, allocator_type a) -> cell_data
+    {
+        if (auto s = std::get_if<std::pmr::string>(&v))
+            return cell_data{std::in_place_type<std::pmr::string>, *s, a};
+        return v;
+    }
+    static auto with_allocator(cell_data&& v, allocator_type a) -> cell_data
+    {
+        if (auto s = std::get_if<std::pmr::string>(&v))
+            return cell_data{std::in_place_type<std::pmr::string>, std::move(*s), a};
+        return std::move(v);
+    }
+};
+
+struct row {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::vector<cell> cells;
+    int height = 0;
+
+    row() = default;
+    explicit row(allocator_type a)
+        : cells{a}
+    {
+    }
+    row(row const& r, allocator_type a = {})
+        : cells{r.cells, a}
+        , height{r.height}
+    {
+    }
+    row(row&&) = default;
+    row(row&& r, allocator_type a)
+        : cells{std::move(r.cells), a}
+        , height{r.height}
+    {
+    }
+
+    auto operator=(row const&) -> row& = default;
+    auto operator=(row&&) -> row& = default;
+};
+
+struct sheet {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::string name;
+    std::pmr::vector<row> rows;
+    std::pmr::map<int, column> columns;
+    string_mode strings = string_mode::shared;
+
+    sheet() = default;
+    explicit sheet(allocator_type a)
+        : name{a}
+        , rows{a}
+        , columns{a}
+    {
+    }
+    explicit sheet(std::string_view name, allocator_type a = {})
+        : name{name, a}
+        , rows{a}
+        , columns{a}
+    {
+    }
+    sheet(sheet const& s, allocator_type a = {})
+        : name{s.name, a}
+        , rows{s.rows, a}
+        , columns{s.columns, a}
+        , strings{s.strings}
+    {
+    }
+    sheet(sheet&&) = default;
+    sheet(sheet&& s, allocator_type a)
+        : name{std::move(s.name), a}
+        , rows{std::move(s.rows), a}
+        , columns{std::move(s.columns), a}
+        , strings{s.strings}
+    {
+    }
+
+    auto operator=(sheet const&) -> sheet& = default;
+    auto operator=(sheet&&) -> sheet& = default;
+};
+
+struct workbook {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::string app_name;
+    std::pmr::vector<sheet> sheets;
+
+    workbook() = default;
+    explicit workbook(allocator_type a)
+        : app_name{a}
+        , sheets{a}
+    {
+    }
+    workbook(workbook const& w, allocator_type a = {})
+        : app_name{w.app_name, a}
+        , sheets{w.sheets, a}
+    {
+    }
+    workbook(workbook&&) = default;
+    workbook(workbook&& w, allocator_type a)
+        : app_name{std::move(w.app_name), a}
+        , sheets{std::move(w.sheets), a}
+    {
+    }
+
+    auto operator=(workbook const&) -> workbook& = default;
+    auto operator=(workbook&&) -> workbook& = default;
 };
 
 } // namespace xl
\ No newline at end of file
@@ -1,46 +1,366 @@
 #pragma once
 
 #include <xl-miniz.h>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <vector>
+#include <xl/deflate.hpp>
+#include <xl/parallel.hpp>
+#include <xl/part.hpp>
+#include <xl/stats.hpp>
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
 
 namespace xl {
 
-template <typename T>
-    requires(std::is_trivial_v<T> && sizeof(T) == 1)
-inline void pack(std::vector<T>& out, std::map<std::string, std::string> const& content)
+// compression of a part in an archive
+enum class compression {
+    store,     // no compression
+    fast,      // fastest compression
+    normal,    // miniz default compression level
+    best,      // smallest output
+    automatic, // store when a sample of the content looks incompressible, normal otherwise
+};
+
+// stores already compressed media (images) as is, compresses everything else normally
+inline auto default_compression(std::string_view name, part const&) -> compression
+{
+    for (auto ext : {".png", ".jpeg", ".jpg", ".gif"})
+        if (name.ends_with(ext))
+            return compression::store;
+    return compression::normal;
+}
+
+struct pack_options {
+    // number of threads compressing parts, 0 means one per hardware thread
+    //
+    // with more than one thread the parts are compressed in chunks before being written into the
+    // archive in order, the archive then depends on chunk_size but not on the number of threads;
+    // a single thread leaves compression to miniz, which compresses every part in one stream, so
+    // its archive differs from those (the parts it unpacks to are the same)
+    std::size_t threads = 1;
+
+    // size of the chunks parts are split into for compressing them on several threads, every chunk
+    // is compressed independently (which costs a little compression at its start), must not be 0
+    std::size_t chunk_size = std::size_t{1} << 20;
+
+    // when set, timings and sizes of the parts are added to it while packing
+    xl::stats* stats = nullptr;
+
+    // chooses the compression of every part, except pre-compressed parts that are stored as is
+    std::function<xl::compression(std::string_view name, part const&)> policy =
+        default_compression;
+};
+
+namespace detail {
+
+// estimates whether the content is already compressed from the byte entropy of a few samples
+inline auto looks_compressed(std::string_view data) -> bool
+{
+    constexpr auto sample_size = std::size_t{4096};
+    if (data.size() < sample_size)
+        return false;
+
+    auto counts = std::array<std::size_t, 256>{};
+    auto total = std::size_t{0};
+    for (auto at : {std::size_t{0}, (data.size() - sample_size) / 2, data.size() - sample_size}) {
+        for (auto c : data.substr(at, sample_size))
+            ++counts[static_cast<unsigned char>(c)];
+        total += sample_size;
+    }
+
+    auto entropy = 0.0;
+    for (auto n : counts)
+        if (n) {
+            auto const p = double(n) / double(total);
+            entropy -= p * std::log2(p);
+        }
+    return entropy > 7.5; // bits per byte
+}
+
+inline auto compression_level(compression c, part const& p) -> int
+{
+    switch (c) {
+    case compression::store:
+        return MZ_NO_COMPRESSION;
+    case compression::fast:
+        return MZ_BEST_SPEED;
+    case compression::best:
+        return MZ_BEST_COMPRESSION;
+    case compression::automatic:
+        return looks_compressed(p.content()) ? MZ_NO_COMPRESSION : MZ_DEFAULT_LEVEL;
+    default:
+        return MZ_DEFAULT_LEVEL;
+    }
+}
+
+// returns the compression level of every part, indexed like content
+inline auto compression_levels(
+    std::map<std::string, part> const& content, pack_options const& options) -> std::vector<int>
+{
+    auto result = std::vector<int>{};
+    result.reserve(content.size());
+    for (auto const& [name, p] : content)
+        result.push_back(p.deflated ? MZ_DEFAULT_LEVEL
+                                    : compression_level(options.policy(name, p), p));
+    return result;
+}
+
+// compresses the parts that are not compressed yet on options.threads threads, in chunks of
+// options.chunk_size so that a single large part is spread over the threads too; the result is
+// indexed like content, and is empty when compression is left to miniz (a single thread)
+//
+// with options.stats set, the compression time of every part is added to seconds
+inline auto deflate_parts(std::map<std::string, part> const& content,
+    std::vector<int> const& levels, pack_options const& options, std::vector<double>& seconds)
+    -> std::vector<part>
+{
+    if (options.chunk_size == 0)
+        throw std::invalid_argument("chunk size must not be 0");
+    if (options.threads == 1)
+        return {};
+
+    struct task {
+        std::size_t index;
+        std::string_view chunk;
+        bool last;
+    };
+
+    auto tasks = std::vector<task>{};
+    auto i = std::size_t{0};
+    for (auto const& [_, p] : content) {
+        // miniz stores tiny entries uncompressed, leave those and the stored ones to it
+        auto const data = p.content();
+        if (!p.deflated && data.size() > 3 && levels[i] != MZ_NO_COMPRESSION) {
+            for (std::size_t at = 0; at < data.size(); at += options.chunk_size)
+                tasks.push_back({i, data.substr(at, options.chunk_size),
+                    data.size() - at <= options.chunk_size});
+        }
+        ++i;
+    }
+
+    auto chunks = std::vector<part>(tasks.size());
+    auto times = std::vector<double>(options.stats ? tasks.size() : 0);
+    parallel_for(tasks.size(), options.threads, [&](std::size_t t) {
+        auto const timer = stats_timer{options.stats ? &times[t] : nullptr};
+        chunks[t] = deflate_chunk(tasks[t].chunk, levels[tasks[t].index], tasks[t].last);
+    });
+    for (std::size_t t = 0; t < times.size(); ++t)
+        seconds[tasks[t].index] += times[t];
+
+    auto result = std::vector<part>(content.size());
+    for (std::size_t t = 0, end = 0; t < tasks.size(); t = end) {
+        for (end = t; end < tasks.size() && tasks[end].index == tasks[t].index; ++end)
+            ;
+        result[tasks[t].index] = join_chunks(std::span{chunks}.subspan(t, end - t));
+    }
+    return result;
+}
+
+// whether the archive may reach 4 GiB, it then has to be written in the zip64 format from the
+// start: miniz switches to zip64 by itself for entries starting past 4 GiB, but fails to finalize
+// an archive whose last entry ends past it
+inline auto needs_zip64(std::map<std::string, part> const& content,
+    std::vector<part> const& deflated) -> bool
+{
+    auto size = std::uint64_t{0};
+    auto i = std::size_t{0};
+    for (auto const& [name, original] : content) {
+        auto const& p = i < deflated.size() && deflated[i].deflated ? deflated[i] : original;
+        ++i;
+        // deflate may slightly expand incompressible data, headers take a few hundred bytes
+        auto const n = std::uint64_t{p.content().size()};
+        size += n + n / 1024 + 2 * name.size() + 256;
+    }
+    return size > 0xFFFFFFFF;
+}
+
+struct pack_sink_state {
+    std::function<void(std::string_view chunk)> const& sink;
+    mz_uint64 offset = 0;
+    std::exception_ptr error;
+};
+
+inline auto pack_write(void* user, mz_uint64 offset, void const* buf, std::size_t n) -> std::size_t
+{
+    auto& st = *static_cast<pack_sink_state*>(user);
+    if (offset != st.offset) // miniz writes archives front to back, a sink cannot seek
+        return 0;
+
+    try {
+        st.sink({static_cast<char const*>(buf), n});
+    }
+    catch (...) {
+        st.error = std::current_exception();
+        return 0;
+    }
+    st.offset += n;
+    return n;
+}
+
+} // namespace detail
+
+// packs the content into a zip archive, passing it to sink in consecutive chunks as it is
+// produced, so the archive is never kept in memory as a whole
+inline void pack(std::function<void(std::string_view chunk)> const& sink,
+    std::map<std::string, part> const& content, pack_options const& options = {})
 {
+    auto* const stats = options.stats;
+    auto const total = detail::stats_timer{stats ? &stats->pack_seconds : nullptr};
+
+    auto const levels = detail::compression_levels(content, options);
+    auto seconds = std::vector<double>(stats ? content.size() : 0);
+    auto const deflated = detail::deflate_parts(content, levels, options, seconds);
+
+    auto state = detail::pack_sink_state{.sink = sink, .offset = 0, .error = {}};
     mz_zip_archive archive;
     memset(&archive, 0, sizeof(archive));
-    if (!mz_zip_writer_init_heap_v2(&archive, 0, 0, 0))
-        throw std::runtime_error("failed to initialize in-memory archive");
+    archive.m_pWrite = detail::pack_write;
+    archive.m_pIO_opaque = &state;
+    auto const flags = detail::needs_zip64(content, deflated) ? MZ_ZIP_FLAG_WRITE_ZIP64 : 0;
+    if (!mz_zip_writer_init_v2(&archive, 0, mz_uint(flags)))
+        throw std::runtime_error("failed to initialize archive");
 
-    for (auto const& [name, blob] : content) {
+    auto fail = [&](std::string const& what) {
+        mz_zip_writer_end(&archive);
+        if (state.error)
+            std::rethrow_exception(state.error);
+        throw std::runtime_error(what);
+    };
+
+    auto i = std::size_t{0};
+    for (auto const& [name, original] : content) {
         auto fn = name;
         if (fn.starts_with('/'))
             fn = fn.substr(1);
 
-        if (!mz_zip_writer_add_mem(
-                &archive, fn.c_str(), blob.data(), blob.size(), -1)) {
-            mz_zip_writer_end(&archive);
-            throw std::runtime_error("failed to add file to zip: " + fn);
+        // use the pre-compressed form when there is one
+        auto const& p = i < deflated.size() && deflated[i].deflated ? deflated[i] : original;
+        auto const n = i++;
+        auto const offset = state.offset;
+
+        auto ok = mz_bool{};
+        {
+            auto const t = detail::stats_timer{stats ? &seconds[n] : nullptr};
+            if (p.deflated) // pre-compressed parts are stored as is
+                ok = mz_zip_writer_add_mem_ex_v2(&archive, fn.c_str(), p.content().data(),
+                    p.content().size(), nullptr, 0,
+                    mz_uint(MZ_DEFAULT_LEVEL) | MZ_ZIP_FLAG_COMPRESSED_DATA, p.size, p.crc, nullptr,
+                    nullptr, 0, nullptr, 0);
+            else
+                ok = mz_zip_writer_add_mem(
+                    &archive, fn.c_str(), p.content().data(), p.content().size(),
+                    mz_uint(levels[n]));
         }
+        if (!ok)
+            fail("failed to add file to zip: " + fn);
+
+        if (stats)
+            stats->parts.push_back({
+                .name = name,
+                .seconds = seconds[n],
+                .size = original.deflated ? original.size : original.content().size(),
+                .packed_size = state.offset - offset,
+            });
     }
 
-    void* buffer;
-    std::size_t size;
-    if (!mz_zip_writer_finalize_heap_archive(&archive, &buffer, &size)) {
-        mz_zip_writer_end(&archive);
-        throw std::runtime_error("failed to finalize in-memory zip archive");
+    if (!mz_zip_writer_finalize_archive(&archive))
+        fail("failed to finalize zip archive");
+
+    mz_zip_writer_end(&archive);
+}
+
+// packs the content into a zip archive appended to out, out is left unchanged on failure
+template <typename T>
+    requires(std::is_trivial_v<T> && sizeof(T) == 1)
+inline void pack(std::vector<T>& out, std::map<std::string, part> const& content,
+    pack_options const& options = {})
+{
+    auto const size = out.size();
+    try {
+        pack(
+            [&](std::string_view chunk) {
+                auto const p = reinterpret_cast<T const*>(chunk.data());
+                out.insert(out.end(), p, p + chunk.size());
+            },
+            content, options);
     }
+    catch (...) {
+        out.resize(size);
+        throw;
+    }
+}
 
-    out.insert(
-        out.end(), reinterpret_cast<T const*>(buffer), reinterpret_cast<T const*>(buffer) + size);
+// packs parts kept as strings (as writer::files used to hold them) into a zip archive appended to
+// out; the parts refer to the strings, which are not copied
+template <typename T>
+    requires(std::is_trivial_v<T> && sizeof(T) == 1)
+inline void pack(std::vector<T>& out, std::map<std::string, std::string> const& content,
+    pack_options const& options = {})
+{
+    auto parts = std::map<std::string, part>{};
+    for (auto const& [name, data] : content)
+        parts.emplace(name, part{std::as_bytes(std::span{data.data(), data.size()})});
+    pack(out, parts, options);
+}
 
-    mz_free(buffer);
+// packs the content into a zip archive written to the given file
+inline void pack(std::filesystem::path const& path, std::map<std::string, part> const& content,
+    pack_options const& options = {})
+{
+    auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error("failed to open file: " + path.string());
 
-    mz_zip_writer_end(&archive);
+    pack(
+        [&](std::string_view chunk) {
+            if (!file.write(chunk.data(), std::streamsize(chunk.size())))
+                throw std::runtime_error("failed to write file: " + path.string());
+        },
+        content, options);
+
+    file.close();
+    if (!file)
+        throw std::runtime_error("failed to write file: " + path.string());
 }
 
-} // namespace xl
\ No newline at end of file
+#if __has_include(<unistd.h>)
+
+// packs the content into a zip archive written to the given file descriptor (a file, pipe or
+// socket), the descriptor is not closed
+inline void pack(
+    int fd, std::map<std::string, part> const& content, pack_options const& options = {})
+{
+    pack(
+        [&](std::string_view chunk) {
+            while (!chunk.empty()) {
+                auto const n = ::write(fd, chunk.data(), chunk.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::system_error(
+                        n < 0 ? errno : EIO, std::generic_category(), "failed to write zip");
+                chunk.remove_prefix(std::size_t(n));
+            }
+        },
+        content, options);
+}
+
+#endif
+
+} // namespace xl
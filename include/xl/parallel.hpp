@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xl::detail {
+
+// calls f(i) for every i in [0, n) on up to the given number of threads, 0 meaning one per
+// hardware thread; indices are handed out in order, and the first exception thrown by f is
+// rethrown once all the threads are done
+template <typename F> void parallel_for(std::size_t n, std::size_t threads, F&& f)
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, n);
+
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < n; ++i)
+            f(i);
+        return;
+    }
+
+    auto next = std::atomic<std::size_t>{0};
+    auto error = std::exception_ptr{};
+    auto error_mutex = std::mutex{};
+
+    auto work = [&] {
+        for (auto i = next++; i < n; i = next++) {
+            try {
+                f(i);
+            }
+            catch (...) {
+                auto lock = std::lock_guard{error_mutex};
+                if (!error)
+                    error = std::current_exception();
+                next = n;
+            }
+        }
+    };
+
+    {
+        auto pool = std::vector<std::jthread>{};
+        for (std::size_t t = 1; t < threads; ++t)
+            pool.emplace_back(work);
+        work();
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+} // namespace xl::detail
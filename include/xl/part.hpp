@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace xl {
+
+// content of a single package part
+//
+// parts normally keep their content as is, parts produced by an encoder (see
+// writer::sheet_encoder) keep a raw deflate stream instead, along with the size and the crc-32 of
+// the content it decompresses to
+//
+// instead of a copy in data, a part can also refer to bytes stored elsewhere (media), which are
+// kept alive by owner when it is set, and must otherwise outlive the part
+struct part {
+    std::string data;
+    bool deflated = false;
+    std::uint64_t size = 0;
+    std::uint32_t crc = 0;
+    std::span<std::byte const> borrowed;
+    std::shared_ptr<void const> owner;
+
+    part() = default;
+    part(std::string content)
+        : data{std::move(content)}
+    {
+    }
+    part(std::span<std::byte const> bytes, std::shared_ptr<void const> owner = {})
+        : borrowed{bytes}
+        , owner{std::move(owner)}
+    {
+    }
+
+    // returns the (possibly compressed) bytes of the part
+    auto content() const -> std::string_view
+    {
+        if (borrowed.data())
+            return {reinterpret_cast<char const*>(borrowed.data()), borrowed.size()};
+        return data;
+    }
+};
+
+// receives the content of a part in chunks as it is produced, and turns it into a part when
+// finished
+struct part_encoder {
+    std::function<void(std::string_view chunk)> write;
+    std::function<part()> finish;
+};
+
+} // namespace xl
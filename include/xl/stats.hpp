@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xl {
+
+// timings and counters of writing and packing a workbook, filled in by writer and xl::pack when
+// writer::stats or pack_options::stats point to one; times are in seconds and add up over calls
+struct stats {
+    struct sheet_stats {
+        std::string name;
+        double seconds = 0; // time spent serializing the sheet
+        std::uint64_t rows = 0;
+        std::uint64_t cells = 0;
+        std::uint64_t size = 0;           // size of the sheet XML
+        std::uint64_t inline_strings = 0; // string cells written inline (string_mode)
+    };
+
+    struct part_stats {
+        std::string name;
+        double seconds = 0;            // time spent compressing and writing the part
+        std::uint64_t size = 0;        // size of the part content
+        std::uint64_t packed_size = 0; // bytes taken in the archive, headers included
+    };
+
+    std::vector<sheet_stats> sheets;
+    double workbook_seconds = 0; // workbook and document properties
+    double media_seconds = 0;    // media and rich data parts
+    double shared_strings_seconds = 0;
+    double styles_seconds = 0;
+    double rels_seconds = 0; // relationships and content types
+
+    std::uint64_t shared_string_hits = 0;
+    std::uint64_t shared_string_misses = 0; // the number of distinct shared strings
+    std::uint64_t styles = 0;               // the number of distinct cell formats
+
+    std::vector<part_stats> parts;
+    double pack_seconds = 0;
+};
+
+namespace detail {
+
+// adds the time from its construction to its destruction to seconds, when not null
+struct stats_timer {
+    double* seconds;
+    std::chrono::steady_clock::time_point start;
+
+    explicit stats_timer(double* seconds)
+        : seconds{seconds}
+    {
+        if (seconds)
+            start = std::chrono::steady_clock::now();
+    }
+    stats_timer(stats_timer const&) = delete;
+    ~stats_timer()
+    {
+        if (seconds)
+            *seconds +=
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+} // namespace detail
+
+} // namespace xl
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <xl/fnv64.hpp>
+
+namespace xl {
+
+// insertion-ordered set of distinct strings, used for the shared string table
+//
+// string contents are stored back to back in a single append-only arena and indexed by an
+// open-addressing hash table with linear probing; lookups take a string_view, so interning a
+// string that is already known never allocates
+struct string_table {
+    static constexpr auto npos = std::size_t(-1);
+
+    struct entry {
+        std::size_t offset;
+        std::size_t size;
+        std::uint64_t hash;
+    };
+
+    // hash table slot, index is the entry index + 1, or 0 for an empty slot
+    struct slot {
+        std::uint32_t index;
+        std::uint32_t hash; // upper half of the entry hash, to skip most mismatching compares
+    };
+
+    std::string arena;
+    std::vector<entry> entries;
+    std::vector<slot> slots; // size is zero or a power of two
+
+    auto intern(std::string_view s) -> std::size_t;
+    auto find(std::string_view s) const -> std::size_t;
+    auto size() const -> std::size_t { return entries.size(); }
+    auto empty() const -> bool { return entries.empty(); }
+    auto operator[](std::size_t i) const -> std::string_view;
+    void clear();
+
+    auto probe(std::string_view s, std::uint64_t hash) const -> std::size_t;
+    void rehash(std::size_t slot_count);
+};
+
+inline auto string_table::operator[](std::size_t i) const -> std::string_view
+{
+    auto const& e = entries[i];
+    return {arena.data() + e.offset, e.size};
+}
+
+// returns the index of the slot that holds s, or of the empty slot where it would be inserted
+inline auto string_table::probe(std::string_view s, std::uint64_t hash) const -> std::size_t
+{
+    auto const mask = slots.size() - 1;
+    auto const tag = std::uint32_t(hash >> 32);
+    for (auto i = std::size_t(hash) & mask;; i = (i + 1) & mask) {
+        auto const& sl = slots[i];
+        if (!sl.index)
+            return i;
+        if (sl.hash == tag && (*this)[sl.index - 1] == s)
+            return i;
+    }
+}
+
+inline auto string_table::find(std::string_view s) const -> std::size_t
+{
+    if (slots.empty())
+        return npos;
+    auto const& sl = slots[probe(s, fnv64(s.data(), s.size()))];
+    return sl.index ? sl.index - 1 : npos;
+}
+
+// returns the index of s, adding it to the table if it is not there yet
+inline auto string_table::intern(std::string_view s) -> std::size_t
+{
+    // keep the load factor at or below 1/2
+    if ((entries.size() + 1) * 2 > slots.size())
+        rehash(slots.empty() ? 1024 : slots.size() * 2);
+
+    auto const hash = fnv64(s.data(), s.size());
+    auto& sl = slots[probe(s, hash)];
+    if (sl.index)
+        return sl.index - 1;
+
+    auto const i = entries.size();
+    entries.push_back(entry{.offset = arena.size(), .size = s.size(), .hash = hash});
+    arena.append(s);
+    sl = slot{.index = std::uint32_t(i + 1), .hash = std::uint32_t(hash >> 32)};
+    return i;
+}
+
+inline void string_table::rehash(std::size_t slot_count)
+{
+    slots.assign(slot_count, slot{});
+    auto const mask = slot_count - 1;
+    for (std::size_t n = 0; n < entries.size(); ++n) {
+        auto const hash = entries[n].hash;
+        auto i = std::size_t(hash) & mask;
+        while (slots[i].index)
+            i = (i + 1) & mask;
+        slots[i] = slot{.index = std::uint32_t(n + 1), .hash = std::uint32_t(hash >> 32)};
+    }
+}
+
+// removes all the strings, keeping the allocated storage
+inline void string_table::clear()
+{
+    arena.clear();
+    entries.clear();
+    slots.assign(slots.size(), slot{});
+}
+
+} // namespace xl
@@ -1,17 +1,72 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <charconv>
+#include <concepts>
+#include <limits>
 #include <map>
+#include <memory>
 #include <optional>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <xl/fnv64.hpp>
 #include <xl/model.hpp>
+#include <xl/parallel.hpp>
+#include <xl/part.hpp>
+#include <xl/stats.hpp>
+#include <xl/string_table.hpp>
 #include <xl/xml.hpp>
 
 namespace xl {
 
+namespace detail {
+
+struct xf_hash {
+    auto operator()(xl::xf const& v) const -> std::size_t;
+};
+
+struct xf_equal {
+    auto operator()(xl::xf const& a, xl::xf const& b) const -> bool;
+};
+
+// decides whether the string cells of a sheet are written inline, column by column (string_mode)
+//
+// an automatic column writes its first sample_size strings as shared strings and switches to
+// inline strings when most of them were distinct; the decision depends only on the sheet's own
+// rows, so sheets written in parallel make the same decisions as when written one by one
+// the column settings of a sheet, by column number: a std::map, or the std::pmr::map of a model
+// sheet, which is read in place rather than copied to the default resource
+template <typename T>
+concept column_map = std::same_as<typename T::value_type, std::pair<int const, column>>;
+
+struct string_policy {
+    static constexpr std::size_t sample_size = 1000;
+
+    struct column_state {
+        string_mode mode = string_mode::shared;
+        std::size_t sampled = 0;
+        std::unordered_set<std::uint64_t> sample; // hashes of the sampled strings
+    };
+
+    string_mode mode = string_mode::shared;
+    std::vector<column_state> columns; // by column number - 1, grown as needed
+    std::size_t inlined = 0;           // the number of strings written inline
+
+    string_policy() = default;
+    template <column_map Columns> string_policy(string_mode mode, Columns const& overrides);
+
+    auto inline_string(int column, std::string_view s) -> bool;
+};
+
+} // namespace detail
+
 struct writer {
     struct rel_info {
         std::string type;
@@ -20,12 +75,43 @@ struct writer {
 
     struct media_info {
         std::string name;
-        std::vector<std::byte> const& blob;
+        std::span<std::byte const> blob;
+        std::shared_ptr<void const> owner; // keeps blob alive when set
         std::size_t iid;
         std::string rid;
     };
 
-    std::map<std::string, std::string> files;
+    struct sheet_info {
+        std::string name;
+        int sheet_id;
+        std::string rid;
+    };
+
+    struct sheet_stream;
+    struct sheet_tables;
+    struct model_tables;
+
+    std::map<std::string, part> files;
+
+    std::vector<sheet_info> sheets; // in workbook order
+
+    // optional encoder for worksheet parts (see xl::deflate_encoder), when set the sheet XML is
+    // handed over to it in chunks of about flush_size bytes while being written, and only the
+    // encoded part is kept in files
+    std::function<part_encoder()> sheet_encoder;
+    std::size_t flush_size = 64 * 1024;
+
+    // number of threads used by write() to serialize sheets, 0 means one per hardware thread
+    //
+    // the output does not depend on the number of threads
+    std::size_t threads = 1;
+
+    // when set, timings and counters are added to it while writing
+    xl::stats* stats = nullptr;
+
+    // total capacity, in bytes, of the part buffers that reset() keeps for the next workbook (the
+    // largest that fit), the others are released; 0 keeps none
+    std::size_t max_spare_size = std::size_t{64} << 20;
 
     std::map<std::string, rel_info> global_rels;    // maps id to absolute path
     std::map<std::string, rel_info> workbook_rels;  // maps id to absolute paths
@@ -34,31 +120,55 @@ struct writer {
     std::map<std::string, std::string> default_content_types; // maps[path extension]->content-type
     std::map<std::string, std::string> part_content_types;    // maps [path partname]->content-type
 
-    std::vector<std::string> shared_strings;
-    std::map<std::string, std::size_t> shared_string_map;
+    string_table shared_strings;
 
     std::vector<media_info> media;
     std::map<std::string, std::size_t> media_map; // maps media name to media index
 
     std::vector<xl::xf> cell_xfs;
+    std::unordered_map<xl::xf, std::size_t, detail::xf_hash, detail::xf_equal> cell_xf_map;
 
     int last_global_id = 0;
     int last_workbook_id = 0;
     int last_rich_data_id = 0;
 
+    std::size_t open_sheets = 0; // sheet streams that are neither closed nor destroyed
+
+    std::vector<std::string> spare_buffers; // part buffers kept by reset(), by capacity
+
     writer();
 
+    void reset();
+    void release_buffers();
+    auto take_buffer() -> std::string;
+
     void write(workbook const& wb);
 
-    auto shared_string(std::string const&) -> std::size_t;
+    auto open_sheet(std::string_view name, std::map<int, column> const& columns = {},
+        string_mode strings = string_mode::shared) -> sheet_stream;
+    template <detail::column_map Columns>
+    auto open_sheet(std::string_view name, Columns const& columns, string_mode strings)
+        -> sheet_stream;
+    void finish(std::string_view app_name = {});
+
+    auto shared_string(std::string_view) -> std::size_t;
+    auto string_id(std::string_view) -> shared_string_id;
+    auto style(xl::xf const&) -> std::size_t;
+    auto picture(cell_picture const&, bool borrow = false) -> std::size_t;
     auto next_global_id() -> int;
     auto next_workbook_id() -> int;
     auto next_rich_data_id() -> int;
     auto rel_id(int id) -> std::string;
     void write_core_properties();
-    void write_extended_properties(std::string const& appname);
-    void write_workbook(workbook const&);
-    void write_sheet(sheet const& sheet, std::string const& sheet_rid);
+    void write_extended_properties(std::string_view appname);
+    void write_workbook();
+    void write_sheet(sheet const& sheet);
+    void write_sheet(columnar_sheet const& sheet);
+    void write_sheets(std::span<sheet const> sheets);
+    template <typename Tables>
+    void write_row(xw& w, row const& row, int row_number, Tables& tables,
+        detail::string_policy& strings);
+    void write_row(xw& w, columnar_sheet const& sheet, std::size_t row, int row_number);
     void write_shared_strings();
     void write_styles();
     void write_media();
@@ -71,6 +181,81 @@ struct writer {
     void write_content_types();
 };
 
+// serializes a worksheet one row at a time, see writer::open_sheet
+//
+// rows are written to the sheet XML as they are appended and are not retained, the part is
+// added to writer::files when the stream is closed
+//
+// the sheet is registered with the writer when the stream is opened; a stream destroyed without
+// being closed (e.g. when appending a row throws) removes the sheet again, and writer::finish
+// throws while a stream is still open
+struct writer::sheet_stream {
+    writer& owner;
+    std::string path;
+    std::string rid;
+    std::string buffer;
+    part_encoder encoder;
+    detail::string_policy strings;
+    int row_number = 0;
+    std::size_t stats_index = 0; // into owner.stats->sheets
+    bool closed = false;
+
+    sheet_stream(writer& owner, std::string path, std::string rid, std::string buffer,
+        detail::string_policy strings);
+    sheet_stream(sheet_stream&& other) noexcept;
+    sheet_stream(sheet_stream const&) = delete;
+    auto operator=(sheet_stream const&) -> sheet_stream& = delete;
+    ~sheet_stream();
+
+    void append(row const& row);
+    template <typename Tables> void append(row const& row, Tables& tables);
+    void append(columnar_sheet const& sheet, std::size_t row);
+    void reserve(std::size_t xml_size);
+    void flush();
+    auto finish() -> part;
+    void close();
+    auto take_part() -> part;
+    void release();
+};
+
+// shared strings, styles and pictures of a single sheet, for writing sheets in parallel
+//
+// each sheet first collects its values into local tables, these are then merged into the
+// writer in sheet order, which assigns the same indices as writing the sheets one after another
+// would; after the merge the tables are only read, so the sheets can be serialized concurrently
+struct writer::sheet_tables {
+    string_table strings;
+    std::size_t string_lookups = 0;
+    std::vector<std::size_t> string_indices; // local to writer index
+
+    std::unordered_map<xl::xf, std::size_t, detail::xf_hash, detail::xf_equal> styles;
+    std::vector<xl::xf const*> style_order;
+    std::vector<std::size_t> style_indices;
+
+    std::unordered_map<cell_picture const*, std::size_t> pictures;
+    std::vector<cell_picture const*> picture_order;
+    std::vector<std::size_t> picture_indices;
+
+    double seconds = 0; // time spent collecting, when writer::stats is set
+
+    void collect(sheet const& sh);
+    void merge(writer& w);
+
+    auto shared_string(std::string_view s) const -> std::size_t;
+    auto style(xl::xf const& v) const -> std::size_t;
+    auto picture(cell_picture const& pic) const -> std::size_t;
+};
+
+// the writer's own tables, for the rows of a sheet or workbook model, which has to outlive packing
+// anyway: pictures refer to the bytes of the cells instead of copying them
+struct writer::model_tables {
+    writer& w;
+
+    auto shared_string(std::string_view s) -> std::size_t { return w.shared_string(s); }
+    auto style(xl::xf const& v) -> std::size_t { return w.style(v); }
+    auto picture(cell_picture const& pic) -> std::size_t { return w.picture(pic, true); }
+};
+
 namespace detail {
 
 inline auto is_empty(xl::alignment const& v) -> bool
@@ -108,26 +293,337 @@ inline auto operator==(xl::xf const& a, xl::xf const& b) -> bool
     return true;
 }
 
-inline auto find(std::vector<xl::xf> const& xfs, xl::xf const& v) -> std::size_t
+inline auto xf_hash::operator()(xl::xf const& v) const -> std::size_t
+{
+    auto const& a = v.alignment;
+    auto h = fnv64(a.horizontal.data(), a.horizontal.size());
+    h = fnv64(a.vertical.data(), a.vertical.size(), h ^ a.horizontal.size());
+    return std::size_t(h);
+}
+
+inline auto xf_equal::operator()(xl::xf const& a, xl::xf const& b) const -> bool { return a == b; }
+
+// invariant XML of the package parts, and of the beginning and end of the variable ones, spliced
+// in as is instead of being built element by element
+namespace parts {
+
+inline constexpr auto core_properties = std::string_view{
+    R"(<cp:coreProperties xmlns:cp="http://schemas.openxmlformats.org/package/2006/metadata/)"
+    R"(core-properties" xmlns:dc="http://purl.org/dc/elements/1.1/" )"
+    R"(xmlns:dcmitype="http://purl.org/dc/dcmitype/" xmlns:dcterms="http://purl.org/dc/terms/" )"
+    R"(xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance"/>)"};
+
+inline constexpr auto extended_properties_begin = std::string_view{
+    R"(<Properties xmlns="http://schemas.openxmlformats.org/officeDocument/2006/)"
+    R"(extended-properties" xmlns:vt="http://schemas.openxmlformats.org/officeDocument/2006/)"
+    R"(docPropsVTypes">)"};
+inline constexpr auto extended_properties_end = std::string_view{"</Properties>"};
+
+inline constexpr auto workbook_begin = std::string_view{
+    R"(<workbook xmlns="http://schemas.openxmlformats.org/spreadsheetml/2006/main" )"
+    R"(xmlns:r="http://schemas.openxmlformats.org/officeDocument/2006/relationships"><sheets>)"};
+inline constexpr auto workbook_end = std::string_view{"</sheets></workbook>"};
+
+inline constexpr auto worksheet_begin = std::string_view{
+    R"(<worksheet xmlns="http://schemas.openxmlformats.org/spreadsheetml/2006/main" )"
+    R"(xmlns:r="http://schemas.openxmlformats.org/officeDocument/2006/relationships">)"};
+
+inline constexpr auto styles_begin = std::string_view{
+    R"(<styleSheet xmlns="http://schemas.openxmlformats.org/spreadsheetml/2006/main">)"};
+inline constexpr auto styles_end = std::string_view{"</styleSheet>"};
+
+// the single font, fill, border and cell style that all cell formats refer to
+inline constexpr auto styles_skeleton = std::string_view{
+    R"(<fonts count="1"><font></font></fonts>)"
+    R"(<fills count="1"><fill><patternFill patternType="none"/></fill></fills>)"
+    R"(<borders count="1"><border><left/><right/><top/><bottom/><diagonal/></border></borders>)"
+    R"(<cellStyleXfs count="1"><xf borderId="0" fillId="0" fontId="0" numFmtId="0"/>)"
+    R"(</cellStyleXfs>)"};
+inline constexpr auto default_xf =
+    std::string_view{R"(<xf borderId="0" fillId="0" fontId="0" numFmtId="0" xfId="0"/>)"};
+inline constexpr auto xf_begin =
+    std::string_view{R"(<xf borderId="0" fillId="0" fontId="0" numFmtId="0" xfId="0">)"};
+inline constexpr auto aligned_xf_begin = std::string_view{
+    R"(<xf applyAlignment="1" borderId="0" fillId="0" fontId="0" numFmtId="0" xfId="0">)"};
+inline constexpr auto xf_end = std::string_view{"</xf>"};
+
+inline constexpr auto relationships_begin = std::string_view{
+    R"(<Relationships xmlns="http://schemas.openxmlformats.org/package/2006/relationships">)"};
+inline constexpr auto relationships_end = std::string_view{"</Relationships>"};
+
+inline constexpr auto content_types_begin = std::string_view{
+    R"(<Types xmlns="http://schemas.openxmlformats.org/package/2006/content-types">)"};
+inline constexpr auto content_types_end = std::string_view{"</Types>"};
+
+} // namespace parts
+
+template <column_map Columns>
+inline string_policy::string_policy(string_mode mode, Columns const& overrides)
+    : mode{mode}
+{
+    for (auto const& [n, c] : overrides)
+        if (c.strings && n > 0) {
+            if (columns.size() < std::size_t(n))
+                columns.resize(std::size_t(n), {.mode = mode, .sampled = 0, .sample = {}});
+            columns[std::size_t(n) - 1].mode = *c.strings;
+        }
+}
+
+inline auto string_policy::inline_string(int column, std::string_view s) -> bool
+{
+    if (columns.size() < std::size_t(column)) {
+        if (mode != string_mode::automatic) {
+            inlined += mode == string_mode::inline_string;
+            return mode == string_mode::inline_string;
+        }
+        columns.resize(std::size_t(column), {.mode = mode, .sampled = 0, .sample = {}});
+    }
+
+    auto& c = columns[std::size_t(column) - 1];
+    if (c.mode == string_mode::automatic) {
+        c.sample.insert(fnv64(s.data(), s.size()));
+        if (++c.sampled == sample_size) {
+            c.mode = c.sample.size() * 2 > c.sampled ? string_mode::inline_string
+                                                     : string_mode::shared;
+            c.sample = {};
+        }
+        return false;
+    }
+    inlined += c.mode == string_mode::inline_string;
+    return c.mode == string_mode::inline_string;
+}
+
+inline auto decimal_digits(std::uint64_t n) -> std::size_t
+{
+    auto d = std::size_t{1};
+    for (; n >= 10; n /= 10)
+        ++d;
+    return d;
+}
+
+// bytes taken by a value of each kind, with its type attribute and the <v> element
+struct value_sizes {
+    static constexpr std::size_t value = 13;           // type attribute, <v> and </v>
+    static constexpr std::size_t boolean = value + 1;
+    static constexpr std::size_t index = value + 7;    // index of a string not registered yet
+    static constexpr std::size_t picture = value + 15; // #VALUE! and a vm attribute
+    static constexpr std::size_t inline_string = 30;   // without the string itself
+    static constexpr std::size_t style = 8;
+};
+
+// bytes taken by the given value, formatted as write_row does
+template <typename T>
+    requires(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>)
+inline auto value_size(T v) -> std::size_t
+{
+    char b[32];
+    auto [p, _] = std::to_chars(b, b + sizeof(b), v);
+    return value_sizes::value + std::size_t(p - b);
+}
+
+inline auto value_size(bool) -> std::size_t { return value_sizes::boolean; }
+
+inline auto value_size(shared_string_id id) -> std::size_t
 {
-    for (std::size_t i = 0; i < xfs.size(); ++i)
-        if (xfs[i] == v)
-            return i;
-    return std::size_t(-1);
+    return value_sizes::value + decimal_digits(id.index);
+}
+
+// estimates the size of the XML of a sheet from its number of rows and the cells of a sample of
+// them, for allocating the sheet buffer once (see sheet_stream::reserve)
+//
+// numbers are counted with the digits of the sampled values; the strings of automatic columns
+// are counted as shared strings, or inline when most of the sampled ones are distinct, which is
+// what string_policy decides from its own sample
+inline auto estimated_size(sheet const& sh) -> std::size_t
+{
+    constexpr auto sample_rows = std::size_t{1024};
+
+    // <c r="AB12"></c> and <row r="12"></row>
+    auto const digits = decimal_digits(sh.rows.size());
+    auto const cell = 14 + digits;
+
+    // the string mode of the columns that set one, the others use the mode of the sheet
+    auto modes = std::vector<string_mode>{};
+    for (auto const& [n, c] : sh.columns)
+        if (c.strings && n > 0) {
+            if (modes.size() < std::size_t(n))
+                modes.resize(std::size_t(n), sh.strings);
+            modes[std::size_t(n) - 1] = *c.strings;
+        }
+
+    // strings of the automatic columns, counted as shared until the sample is complete
+    struct automatic_column {
+        std::size_t strings = 0;
+        std::size_t inline_size = 0;
+        std::unordered_set<std::uint64_t> distinct;
+    };
+    auto automatic = std::vector<automatic_column>{};
+
+    auto const stride = std::max<std::size_t>(1, sh.rows.size() / sample_rows);
+    auto sampled = std::size_t{0};
+    auto size = std::size_t{0};
+    for (std::size_t i = 0; i < sh.rows.size(); i += stride, ++sampled) {
+        size += 16 + digits;
+        auto column = std::size_t{0};
+        for (auto const& c : sh.rows[i].cells) {
+            auto const value = std::visit(
+                [&](auto const& v) -> std::size_t {
+                    using type = std::decay_t<decltype(v)>;
+                    if constexpr (std::is_same_v<type, std::monostate>)
+                        return 0; // empty cells are not written
+                    else if constexpr (std::is_same_v<type, cell_picture>)
+                        return value_sizes::picture;
+                    else if constexpr (std::is_same_v<type, std::pmr::string>) {
+                        auto const mode = column < modes.size() ? modes[column] : sh.strings;
+                        if (mode == string_mode::inline_string)
+                            return value_sizes::inline_string + v.size();
+                        if (mode == string_mode::automatic) {
+                            if (automatic.size() <= column)
+                                automatic.resize(column + 1);
+                            auto& a = automatic[column];
+                            ++a.strings;
+                            a.inline_size += value_sizes::inline_string + v.size();
+                            a.distinct.insert(fnv64(v.data(), v.size()));
+                        }
+                        return value_sizes::index;
+                    }
+                    else
+                        return value_size(v);
+                },
+                c.data);
+            ++column;
+            if (value)
+                size += cell + value + (c.style || !is_empty(c.xf) ? value_sizes::style : 0);
+        }
+    }
+    for (auto const& a : automatic)
+        if (a.distinct.size() * 2 > a.strings)
+            size += a.inline_size - a.strings * value_sizes::index;
+
+    auto const base = std::size_t{512}; // declaration, worksheet and columns
+    return base + (sampled ? size * sh.rows.size() / sampled : 0);
+}
+
+inline auto estimated_size(columnar_sheet const& sh) -> std::size_t
+{
+    constexpr auto sample_rows = std::size_t{1024};
+
+    auto const digits = decimal_digits(sh.rows);
+    auto const cell = 14 + digits;
+
+    auto const stride = std::max<std::size_t>(1, sh.rows / sample_rows);
+    auto const sampled = sh.rows ? (sh.rows - 1) / stride + 1 : 0;
+    auto size = std::size_t{0};
+    for (auto const& c : sh.columns) {
+        auto const style = c.style || !c.styles.empty() ? value_sizes::style : 0;
+        size += std::visit(
+            [&](auto const& values) {
+                using value_type = typename std::decay_t<decltype(values)>::value_type;
+                auto n = std::size_t{0};
+                for (std::size_t i = 0; i < sh.rows; i += stride)
+                    if (!c.is_null(i))
+                        n += cell + style + value_size(value_type(values[i]));
+                return n;
+            },
+            c.values);
+    }
+
+    auto const base = std::size_t{512}; // declaration, worksheet and columns
+    auto const rows = (16 + digits) * sh.rows;
+    return base + rows + (sampled ? size * sh.rows / sampled : 0);
 }
 
 } // namespace detail
 
-inline writer::writer()
+inline writer::writer() { reset(); }
+
+// clears everything written so far, for writing another workbook with the same writer
+//
+// the configuration (sheet_encoder, flush_size, threads, stats, max_spare_size) is kept, and so is
+// the storage of the string, style and media tables; the buffers of the parts are kept too, up to
+// max_spare_size bytes, and reused for the parts of the next workbook, largest first, which go to
+// the sheets as they are opened first
+inline void writer::reset()
 {
+    if (open_sheets)
+        throw std::runtime_error("a sheet stream is still open");
+
+    for (auto& [_, p] : files)
+        if (p.data.capacity() > std::string{}.capacity()) { // not a short string
+            p.data.clear();
+            spare_buffers.push_back(std::move(p.data));
+        }
+    std::sort(spare_buffers.begin(), spare_buffers.end(),
+        [](auto const& a, auto const& b) { return a.capacity() < b.capacity(); });
+    auto budget = max_spare_size;
+    for (auto it = spare_buffers.rbegin(); it != spare_buffers.rend(); ++it)
+        if (it->capacity() <= budget)
+            budget -= it->capacity();
+        else
+            std::string{}.swap(*it); // frees the buffer, assigning an empty string would keep it
+    std::erase_if(spare_buffers,
+        [](auto const& b) { return b.capacity() <= std::string{}.capacity(); });
+    files.clear();
+    sheets.clear();
+
+    global_rels.clear();
+    workbook_rels.clear();
+    rich_data_rels.clear();
+    default_content_types.clear();
+    part_content_types.clear();
     default_content_types["xml"] = "application/xml";
     default_content_types["rels"] = "application/vnd.openxmlformats-package.relationships+xml";
+
+    shared_strings.clear();
+    media.clear();
+    media_map.clear();
+    cell_xfs.clear();
+    cell_xf_map.clear();
+
+    last_global_id = 0;
+    last_workbook_id = 0;
+    last_rich_data_id = 0;
+}
+
+// frees the part buffers kept by reset(), e.g. before a writer stays idle for a while
+inline void writer::release_buffers() { spare_buffers = {}; }
+
+// returns an empty buffer for a part, reusing the storage of a previous workbook when there is one
+inline auto writer::take_buffer() -> std::string
+{
+    if (spare_buffers.empty())
+        return {};
+    auto buf = std::move(spare_buffers.back());
+    spare_buffers.pop_back();
+    return buf;
 }
 
 inline void writer::write(workbook const& wb)
 {
-    write_workbook(wb);
+    if (threads != 1 && wb.sheets.size() > 1)
+        write_sheets(wb.sheets);
+    else
+        for (auto const& sheet : wb.sheets)
+            write_sheet(sheet);
+    finish(wb.app_name);
+}
+
+// writes the workbook and all the shared parts, must be called after all the sheets are closed
+inline void writer::finish(std::string_view app_name)
+{
+    if (open_sheets)
+        throw std::runtime_error("a sheet stream is still open");
+
+    auto phase = [&](double xl::stats::*seconds) {
+        return detail::stats_timer{stats ? &(stats->*seconds) : nullptr};
+    };
+
+    {
+        auto const t = phase(&xl::stats::workbook_seconds);
+        write_workbook();
+    }
     if (!media.empty()) {
+        auto const t = phase(&xl::stats::media_seconds);
         write_media();
         write_rich_value_rel();
         write_rels("/xl/richData/_rels/richValueRel.xml.rels", rich_data_rels);
@@ -135,14 +631,24 @@ inline void writer::write(workbook const& wb)
         write_rich_value_data();
         write_metadata();
     }
-    write_core_properties();
-    write_extended_properties(wb.app_name);
-    if (!shared_strings.empty())
+    {
+        auto const t = phase(&xl::stats::workbook_seconds);
+        write_core_properties();
+        write_extended_properties(app_name);
+    }
+    if (!shared_strings.empty()) {
+        auto const t = phase(&xl::stats::shared_strings_seconds);
         write_shared_strings();
+    }
 
-    if (!cell_xfs.empty())
+    if (!cell_xfs.empty()) {
+        auto const t = phase(&xl::stats::styles_seconds);
         write_styles();
+    }
+    if (stats)
+        stats->styles = cell_xfs.size();
 
+    auto const t = phase(&xl::stats::rels_seconds);
     write_rels("/xl/_rels/workbook.xml.rels", workbook_rels);
     write_rels("/_rels/.rels", global_rels);
 
@@ -168,23 +674,15 @@ inline void writer::write_core_properties()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
-    w.node("cp:coreProperties",
-        {
-            {"xmlns:cp", "http://schemas.openxmlformats.org/package/2006/metadata/core-properties"},
-            {"xmlns:dc", "http://purl.org/dc/elements/1.1/"},
-            {"xmlns:dcterms", "http://purl.org/dc/terms/"},
-            {"xmlns:dcmitype", "http://purl.org/dc/dcmitype/"},
-            {"xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance"},
-        },
-        {});
+    w.put(detail::parts::core_properties);
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-inline void writer::write_extended_properties(std::string const& appname)
+inline void writer::write_extended_properties(std::string_view appname)
 {
     auto rid = rel_id(next_global_id());
 
@@ -199,23 +697,18 @@ inline void writer::write_extended_properties(std::string const& appname)
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
-    w.node("Properties",
-        {
-            {"xmlns", "http://schemas.openxmlformats.org/officeDocument/2006/extended-properties"},
-            {"xmlns:vt", "http://schemas.openxmlformats.org/officeDocument/2006/docPropsVTypes"},
-        },
-        [&](xl::xw& w) {
-            if (!appname.empty())
-                w.node("Application", {}, [&](xl::xw& w) { w.scramble(appname); });
-        });
+    w.put(detail::parts::extended_properties_begin);
+    if (!appname.empty())
+        w.node("Application", {}, [&](xl::xw& w) { w.scramble(appname); });
+    w.put(detail::parts::extended_properties_end);
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-inline void writer::write_workbook(workbook const& wb)
+inline void writer::write_workbook()
 {
     auto rid = rel_id(next_global_id());
 
@@ -230,48 +723,90 @@ inline void writer::write_workbook(workbook const& wb)
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
-    w.node("workbook",
-        {
-            {"xmlns", "http://schemas.openxmlformats.org/spreadsheetml/2006/main"},
-            {"xmlns:r", "http://schemas.openxmlformats.org/officeDocument/2006/relationships"},
-        },
-        [&](xw& w) {
-            w.node("sheets", {}, [&](xw& w) {
-                for (auto const& sheet : wb.sheets) {
-                    auto const sheet_id = next_workbook_id();
-                    auto const sheet_rid = rel_id(sheet_id);
-                    w.node("sheet",
-                        {
-                            {"name", sheet.name},
-                            {"sheetId", std::to_string(sheet_id)},
-                            {"r:id", sheet_rid},
-                        },
-                        {});
-                    write_sheet(sheet, sheet_rid);
-                }
+    w.put(detail::parts::workbook_begin);
+    for (auto const& sheet : sheets)
+        w.node("sheet",
+            {
+                {"name", sheet.name},
+                {"r:id", sheet.rid},
+                {"sheetId", sheet.sheet_id},
             });
-        });
+    w.put(detail::parts::workbook_end);
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
 inline auto col_number_as_letters(int n) -> std::string
 {
+    if (n >= 1 && n <= max_columns)
+        return std::string{column_letters(n)};
+
     auto s = std::string{};
     while (n > 0) {
-        auto c = char((n - 1) % 26 + 65);
-        s = std::string{c} + s;
+        s += char((n - 1) % 26 + 65);
         n = (n - 1) / 26;
     }
-    return s;
+    return {s.rbegin(), s.rend()};
+}
+
+inline void writer::write_sheet(sheet const& sh)
+{
+    auto s = open_sheet(sh.name, sh.columns, sh.strings);
+    s.reserve(detail::estimated_size(sh));
+    auto tables = model_tables{*this};
+    for (auto const& row : sh.rows)
+        s.append(row, tables);
+    s.close();
+}
+
+// writes a columnar sheet row by row, in a single pass over its columns
+inline void writer::write_sheet(columnar_sheet const& sh)
+{
+    if (sh.columns.size() > std::size_t(max_columns))
+        throw std::runtime_error("too many columns in a sheet");
+    for (auto const& c : sh.columns) {
+        auto const size = std::visit([](auto const& v) { return v.size(); }, c.values);
+        if (size < sh.rows || (!c.styles.empty() && c.styles.size() < sh.rows))
+            throw std::runtime_error("columnar sheet column is shorter than the sheet");
+        auto const registered = [&](std::size_t style) { return style <= cell_xfs.size(); };
+        auto const styles = std::span{c.styles}.first(c.styles.empty() ? 0 : sh.rows);
+        if (!registered(c.style) || !std::ranges::all_of(styles, registered))
+            throw std::runtime_error("columnar sheet style is not registered");
+        if (auto ids = std::get_if<std::vector<shared_string_id>>(&c.values))
+            for (std::size_t i = 0; i < sh.rows; ++i)
+                if ((*ids)[i].index >= shared_strings.size() && !c.is_null(i))
+                    throw std::runtime_error("shared string id is not registered");
+    }
+
+    auto s = open_sheet(sh.name, sh.widths);
+    s.reserve(detail::estimated_size(sh));
+    for (std::size_t i = 0; i < sh.rows; ++i)
+        s.append(sh, i);
+    s.close();
+}
+
+inline auto writer::open_sheet(std::string_view name, std::map<int, column> const& columns,
+    string_mode strings) -> sheet_stream
+{
+    return open_sheet<std::map<int, column>>(name, columns, strings);
 }
 
-inline void writer::write_sheet(sheet const& sh, std::string const& rid)
+template <detail::column_map Columns>
+inline auto writer::open_sheet(std::string_view name, Columns const& columns, string_mode strings)
+    -> sheet_stream
 {
-    auto const relpath = std::string{"worksheets/"} + sh.name + ".xml";
+    auto const sheet_id = next_workbook_id();
+    auto const rid = rel_id(sheet_id);
+    sheets.push_back(sheet_info{
+        .name = std::string{name},
+        .sheet_id = sheet_id,
+        .rid = rid,
+    });
+
+    auto const relpath = std::string{"worksheets/"}.append(name) + ".xml";
     auto const abspath = std::string{"/xl/"} + relpath;
 
     part_content_types[abspath] =
@@ -281,126 +816,402 @@ inline void writer::write_sheet(sheet const& sh, std::string const& rid)
         .target = relpath,
     };
 
-    auto buf = std::string{};
-    auto w = xw{buf};
+    auto s = sheet_stream{
+        *this, abspath, rid, take_buffer(), detail::string_policy{strings, columns}};
+    if (stats) {
+        s.stats_index = stats->sheets.size();
+        stats->sheets.push_back({.name = std::string{name}});
+    }
+    if (sheet_encoder)
+        s.encoder = sheet_encoder();
+
+    auto w = xw{s.buffer};
     w.write_decl();
-    w.node("worksheet",
-        {
-            {"xmlns", "http://schemas.openxmlformats.org/spreadsheetml/2006/main"},
-            {"xmlns:r", "http://schemas.openxmlformats.org/officeDocument/2006/relationships"},
-        },
-        [&](xl::xw& w) {
-            if (!sh.columns.empty())
-                w.node("cols", {}, [&](xl::xw& w) {
-                    for (auto const& [n, c] : sh.columns) {
-                        auto attrs = std::map<std::string, std::string>{
-                            {"min", std::to_string(n)}, {"max", std::to_string(n)}};
-                        if (c.width > 0) {
-                            attrs["width"] = std::to_string(c.width);
-                            attrs["customWidth"] = "1";
-                        }
-                        w.node("col", attrs, {});
-                    }
-                });
+    w.put(detail::parts::worksheet_begin);
+
+    if (!columns.empty())
+        w.node("cols", {}, [&](xl::xw& w) {
+            for (auto const& [n, c] : columns) {
+                if (c.width > 0)
+                    w.node("col",
+                        {{"customWidth", "1"}, {"max", n}, {"min", n}, {"width", c.width}});
+                else
+                    w.node("col", {{"max", n}, {"min", n}});
+            }
+        });
 
-            w.node("sheetData", {}, [&](xl::xw& w) {
-                auto row_number = 0;
-                for (auto const& row : sh.rows) {
-                    ++row_number;
-                    auto attrs =
-                        std::map<std::string, std::string>{{"r", std::to_string(row_number)}};
-                    if (row.height > 0) {
-                        attrs["ht"] = std::to_string(row.height);
-                        attrs["customHeight"] = "1";
-                    }
-                    w.node("row", attrs, [&](xl::xw& w) {
-                        auto col_number = 0;
-                        for (auto const& cell : row.cells) {
-                            ++col_number;
-
-                            auto t = std::string{};
-                            auto v = std::string{};
-                            auto vm = std::string{};
-
-                            if (auto d = std::get_if<bool>(&cell.data)) {
-                                t = "b";
-                                v = *d ? "1" : "0";
-                            }
-                            else if (auto d = std::get_if<float>(&cell.data)) {
-                                t = "n";
-                                char bb[64];
-                                auto [p, _] = std::to_chars(bb, bb + 64, *d);
-                                v = {bb, p};
-                            }
-                            else if (auto d = std::get_if<std::string>(&cell.data)) {
-                                auto i = shared_string(*d);
-                                t = "s";
-                                v = std::to_string(i);
-                            }
-                            else if (auto d = std::get_if<cell_picture>(&cell.data)) {
-                                auto ext = d->ext;
-                                if (ext == ".jpeg" || ext == ".jpg") {
-                                    ext = ".jpeg";
-                                    default_content_types["jpeg"] = "image/jpeg";
-                                }
-                                else if (d->ext == ".png")
-                                    default_content_types["png"] = "image/png";
-                                else
-                                    throw std::runtime_error(
-                                        std::string{"unsupported image extension: "} + d->ext);
-
-                                t = "e";
-                                v = "#VALUE!";
-
-                                auto const hash = fnv64(d->blob.data(), d->blob.size());
-                                char bb[64];
-                                auto [p, _] = std::to_chars(bb, bb + 64, hash, 16);
-                                auto n = std::string{bb, p} + ext;
-                                if (auto m = media_map.find(n); m != media_map.end()) {
-                                    vm = std::to_string(m->second);
-                                }
-                                else {
-                                    auto media_id = next_rich_data_id();
-                                    auto iid = media.size();
-                                    media.push_back(media_info{
-                                        .name = n,
-                                        .blob = d->blob,
-                                        .iid = iid,
-                                        .rid = rel_id(media_id),
-                                    });
-                                    media_map[n] = iid;
-                                    vm = std::to_string(iid + 1);
-                                }
-                            }
-
-                            attrs.clear();
-                            attrs["r"] =
-                                col_number_as_letters(col_number) + std::to_string(row_number);
-                            if (!t.empty())
-                                attrs["t"] = t;
-                            if (!vm.empty())
-                                attrs["vm"] = vm;
-
-                            if (!detail::is_empty(cell.xf)) {
-                                auto idx = detail::find(this->cell_xfs, cell.xf);
-                                if (idx >= cell_xfs.size()) {
-                                    idx = cell_xfs.size();
-                                    cell_xfs.push_back(cell.xf);
-                                }
-                                attrs["s"] = std::to_string(idx + 1);
-                            }
-
-                            if (!v.empty())
-                                w.node("c", attrs, [&](xl::xw& w) {
-                                    w.node("v", {}, [&](xl::xw& w) { w.scramble(v); });
-                                });
-                        }
-                    });
+    w.open("sheetData");
+    return s;
+}
+
+inline writer::sheet_stream::sheet_stream(writer& owner, std::string path, std::string rid,
+    std::string buffer, detail::string_policy strings)
+    : owner{owner}
+    , path{std::move(path)}
+    , rid{std::move(rid)}
+    , buffer{std::move(buffer)}
+    , strings{std::move(strings)}
+{
+    ++owner.open_sheets;
+}
+
+inline writer::sheet_stream::sheet_stream(sheet_stream&& other) noexcept
+    : owner{other.owner}
+    , path{std::move(other.path)}
+    , rid{std::move(other.rid)}
+    , buffer{std::move(other.buffer)}
+    , encoder{std::move(other.encoder)}
+    , strings{std::move(other.strings)}
+    , row_number{other.row_number}
+    , stats_index{other.stats_index}
+    , closed{other.closed}
+{
+    other.closed = true; // the registration moves along
+}
+
+// removes the sheet from the workbook when the stream was not closed
+inline writer::sheet_stream::~sheet_stream()
+{
+    if (closed)
+        return;
+    --owner.open_sheets;
+    std::erase_if(owner.sheets, [&](sheet_info const& sh) { return sh.rid == rid; });
+    owner.workbook_rels.erase(rid);
+    owner.part_content_types.erase(path);
+}
+
+inline void writer::sheet_stream::append(row const& row) { append(row, owner); }
+
+template <typename Tables>
+inline void writer::sheet_stream::append(row const& row, Tables& tables)
+{
+    auto* const st = owner.stats ? &owner.stats->sheets[stats_index] : nullptr;
+    auto const t = detail::stats_timer{st ? &st->seconds : nullptr};
+    if (st) {
+        ++st->rows;
+        st->cells += row.cells.size();
+    }
+
+    auto w = xw{buffer};
+    owner.write_row(w, row, ++row_number, tables, strings);
+    flush();
+}
+
+// appends a row of a columnar sheet
+inline void writer::sheet_stream::append(columnar_sheet const& sheet, std::size_t row)
+{
+    auto* const st = owner.stats ? &owner.stats->sheets[stats_index] : nullptr;
+    auto const t = detail::stats_timer{st ? &st->seconds : nullptr};
+    if (st) {
+        ++st->rows;
+        st->cells += sheet.columns.size();
+    }
+
+    auto w = xw{buffer};
+    owner.write_row(w, sheet, row, ++row_number);
+    flush();
+}
+
+// allocates the sheet buffer for about xml_size bytes of XML in total (see
+// detail::estimated_size), so that it does not have to grow while rows are appended; encoded sheets
+// only ever buffer about flush_size bytes and ignore it
+inline void writer::sheet_stream::reserve(std::size_t xml_size)
+{
+    if (!encoder.write)
+        buffer.reserve(xml_size);
+}
+
+// hands the buffered XML over to the encoder once there is at least flush_size of it
+inline void writer::sheet_stream::flush()
+{
+    if (encoder.write && buffer.size() >= owner.flush_size) {
+        encoder.write(buffer);
+        buffer.clear();
+    }
+}
+
+// completes the sheet XML and closes the stream, returning the part without adding it to
+// writer::files
+inline auto writer::sheet_stream::finish() -> part
+{
+    auto result = take_part();
+    release();
+    return result;
+}
+
+// closes the stream, keeping the sheet in the workbook
+inline void writer::sheet_stream::release()
+{
+    if (!closed) {
+        closed = true;
+        --owner.open_sheets;
+    }
+}
+
+// completes the sheet XML and returns the part, leaving the stream open; unlike finish, it does
+// not touch the writer, so that the streams of several sheets can be completed concurrently
+inline auto writer::sheet_stream::take_part() -> part
+{
+    if (closed)
+        throw std::runtime_error("the sheet stream is closed");
+
+    auto* const st = owner.stats ? &owner.stats->sheets[stats_index] : nullptr;
+    auto const t = detail::stats_timer{st ? &st->seconds : nullptr};
+
+    auto w = xw{buffer};
+    w.close("sheetData");
+    w.close("worksheet");
+
+    auto result = part{};
+    if (encoder.write) {
+        encoder.write(buffer);
+        buffer = {};
+        result = encoder.finish();
+    }
+    else
+        result = std::move(buffer);
+
+    if (st) {
+        st->size = result.deflated ? result.size : result.data.size();
+        st->inline_strings = strings.inlined;
+    }
+    return result;
+}
+
+inline void writer::sheet_stream::close() { owner.files[path] = finish(); }
+
+// writes the sheets on the writer's threads, see sheet_tables
+inline void writer::write_sheets(std::span<sheet const> shs)
+{
+    auto tables = std::vector<sheet_tables>(shs.size());
+    detail::parallel_for(shs.size(), threads, [&](std::size_t i) {
+        auto const t = detail::stats_timer{stats ? &tables[i].seconds : nullptr};
+        tables[i].collect(shs[i]);
+    });
+
+    auto streams = std::vector<sheet_stream>{};
+    streams.reserve(shs.size());
+    for (std::size_t i = 0; i < shs.size(); ++i) {
+        tables[i].merge(*this);
+        streams.push_back(open_sheet(shs[i].name, shs[i].columns, shs[i].strings));
+        if (stats) {
+            // the lookups that hit the sheet's own table
+            stats->shared_string_hits += tables[i].string_lookups - tables[i].strings.size();
+            stats->sheets[streams[i].stats_index].seconds += tables[i].seconds;
+        }
+    }
+
+    auto parts = std::vector<part>(shs.size());
+    detail::parallel_for(shs.size(), threads, [&](std::size_t i) {
+        streams[i].reserve(detail::estimated_size(shs[i]));
+        for (auto const& row : shs[i].rows)
+            streams[i].append(row, tables[i]);
+        parts[i] = streams[i].take_part();
+    });
+
+    for (std::size_t i = 0; i < shs.size(); ++i) {
+        streams[i].release();
+        files[streams[i].path] = std::move(parts[i]);
+    }
+}
+
+// the strings to be written inline are left out, as decided by the same string_policy that the
+// sheet stream uses later
+inline void writer::sheet_tables::collect(sheet const& sh)
+{
+    auto policy = detail::string_policy{sh.strings, sh.columns};
+    for (auto const& row : sh.rows) {
+        auto col_number = 0;
+        for (auto const& cell : row.cells) {
+            ++col_number;
+            if (auto d = std::get_if<std::pmr::string>(&cell.data)) {
+                if (!policy.inline_string(col_number, *d)) {
+                    strings.intern(*d);
+                    ++string_lookups;
                 }
-            });
-        });
+            }
+            else if (auto d = std::get_if<cell_picture>(&cell.data)) {
+                if (pictures.try_emplace(d, picture_order.size()).second)
+                    picture_order.push_back(d);
+            }
+
+            if (!cell.style && !detail::is_empty(cell.xf))
+                if (styles.try_emplace(cell.xf, style_order.size()).second)
+                    style_order.push_back(&cell.xf);
+        }
+    }
+}
+
+// registers the collected values with the writer, in the order they were first seen
+inline void writer::sheet_tables::merge(writer& w)
+{
+    // the order of registration within a cell must match write_row: value first, then style
+    string_indices.resize(strings.size());
+    for (std::size_t i = 0; i < strings.size(); ++i)
+        string_indices[i] = w.shared_string(strings[i]);
+
+    picture_indices.resize(picture_order.size());
+    for (std::size_t i = 0; i < picture_order.size(); ++i)
+        picture_indices[i] = w.picture(*picture_order[i], true);
+
+    style_indices.resize(style_order.size());
+    for (std::size_t i = 0; i < style_order.size(); ++i)
+        style_indices[i] = w.style(*style_order[i]);
+}
+
+inline auto writer::sheet_tables::shared_string(std::string_view s) const -> std::size_t
+{
+    return string_indices[strings.find(s)];
+}
+
+inline auto writer::sheet_tables::style(xl::xf const& v) const -> std::size_t
+{
+    if (detail::is_empty(v))
+        return 0;
+    return style_indices[styles.find(v)->second];
+}
+
+inline auto writer::sheet_tables::picture(cell_picture const& pic) const -> std::size_t
+{
+    return picture_indices[pictures.find(&pic)->second];
+}
+
+// writes a row, resolving shared strings, styles and pictures through the given tables (either
+// the writer itself, or sheet_tables when sheets are written in parallel)
+template <typename Tables>
+inline void writer::write_row(
+    xw& w, row const& row, int row_number, Tables& tables, detail::string_policy& strings)
+{
+    auto attrs = std::array<xw::attr, 4>{};
+    auto count = std::size_t{0};
+    if (row.height > 0) {
+        attrs[count++] = {"customHeight", "1"};
+        attrs[count++] = {"ht", row.height};
+    }
+    attrs[count++] = {"r", row_number};
+    w.node("row", std::span{attrs.data(), count}, [&](xl::xw& w) {
+        auto col_number = 0;
+        for (auto const& cell : row.cells) {
+            if (++col_number > max_columns)
+                throw std::runtime_error("too many cells in a row");
+
+            auto t = std::string_view{};
+            auto v = std::string_view{};
+            auto vm = std::size_t{0};
+            auto is = static_cast<std::pmr::string const*>(nullptr); // inline string
+            char vb[32];
+
+            if (auto d = std::get_if<bool>(&cell.data)) {
+                t = "b";
+                v = *d ? "1" : "0";
+            }
+            else if (auto d = std::get_if<float>(&cell.data)) {
+                t = "n";
+                auto [p, _] = std::to_chars(vb, vb + sizeof(vb), *d);
+                v = {vb, p};
+            }
+            else if (auto d = std::get_if<double>(&cell.data)) {
+                t = "n";
+                auto [p, _] = std::to_chars(vb, vb + sizeof(vb), *d); // shortest round trip
+                v = {vb, p};
+            }
+            else if (auto d = std::get_if<std::int64_t>(&cell.data)) {
+                t = "n";
+                v = {vb, format_int(vb, *d)};
+            }
+            else if (auto d = std::get_if<std::pmr::string>(&cell.data)) {
+                if (strings.inline_string(col_number, *d)) {
+                    t = "inlineStr";
+                    is = d;
+                }
+                else {
+                    auto i = tables.shared_string(*d);
+                    t = "s";
+                    v = {vb, format_uint(vb, i)};
+                }
+            }
+            else if (auto d = std::get_if<shared_string_id>(&cell.data)) {
+                if (d->index >= shared_strings.size())
+                    throw std::runtime_error("shared string id is not registered");
+                t = "s";
+                v = {vb, format_uint(vb, d->index)};
+            }
+            else if (auto d = std::get_if<cell_picture>(&cell.data)) {
+                t = "e";
+                v = "#VALUE!";
+                vm = tables.picture(*d);
+            }
 
-    files[abspath] = buf;
+            count = 0;
+            attrs[count++] = {"r", cell_ref{col_number, row_number}};
+
+            if (cell.style > cell_xfs.size())
+                throw std::runtime_error("cell style is not registered");
+            if (auto const s = cell.style ? cell.style : tables.style(cell.xf))
+                attrs[count++] = {"s", s};
+
+            if (!t.empty())
+                attrs[count++] = {"t", t};
+            if (vm)
+                attrs[count++] = {"vm", vm};
+
+            if (is)
+                w.node("c", std::span{attrs.data(), count}, [&](xl::xw& w) {
+                    w.node("is", {}, [&](xl::xw& w) {
+                        w.node("t", {}, [&](xl::xw& w) { w.scramble(*is); });
+                    });
+                });
+            else if (!v.empty())
+                w.node("c", std::span{attrs.data(), count}, [&](xl::xw& w) {
+                    // values are numbers, indices or an error code, there is nothing to escape
+                    w.node("v", {}, [&](xl::xw& w) { w.put(v); });
+                });
+        }
+    });
+}
+
+inline void writer::write_row(xw& w, columnar_sheet const& sh, std::size_t row, int row_number)
+{
+    w.node("row", {{"r", row_number}}, [&](xl::xw& w) {
+        auto attrs = std::array<xw::attr, 3>{};
+        auto col_number = 0;
+        for (auto const& c : sh.columns) {
+            ++col_number;
+            if (c.is_null(row))
+                continue;
+
+            auto t = std::string_view{"n"};
+            auto v = std::string_view{};
+            char vb[32];
+
+            if (auto d = std::get_if<std::vector<double>>(&c.values)) {
+                auto [p, _] = std::to_chars(vb, vb + sizeof(vb), (*d)[row]);
+                v = {vb, p};
+            }
+            else if (auto d = std::get_if<std::vector<std::int64_t>>(&c.values))
+                v = {vb, format_int(vb, (*d)[row])};
+            else if (auto d = std::get_if<std::vector<bool>>(&c.values)) {
+                t = "b";
+                v = (*d)[row] ? "1" : "0";
+            }
+            else if (auto d = std::get_if<std::vector<shared_string_id>>(&c.values)) {
+                if ((*d)[row].index >= shared_strings.size())
+                    throw std::runtime_error("shared string id is not registered");
+                t = "s";
+                v = {vb, format_uint(vb, (*d)[row].index)};
+            }
+
+            auto count = std::size_t{0};
+            attrs[count++] = {"r", cell_ref{col_number, row_number}};
+            if (auto const s = c.style_of(row))
+                attrs[count++] = {"s", s};
+            attrs[count++] = {"t", t};
+
+            w.node("c", std::span{attrs.data(), count}, [&](xl::xw& w) {
+                w.node("v", {}, [&](xl::xw& w) { w.put(v); });
+            });
+        }
+    });
 }
 
 inline void writer::write_shared_strings()
@@ -417,22 +1228,23 @@ inline void writer::write_shared_strings()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
     w.node("sst",
         {
+            {"count", shared_strings.size()},
+            {"uniqueCount", shared_strings.size()},
             {"xmlns", "http://schemas.openxmlformats.org/spreadsheetml/2006/main"},
-            {"count", std::to_string(shared_strings.size())},
-            {"uniqueCount", std::to_string(shared_strings.size())},
         },
         [&](xl::xw& w) {
-            for (auto const& s : shared_strings)
-                w.node("si", {},
-                    [&](xl::xw& w) { w.node("t", {}, [&](xl::xw& w) { w.scramble(s); }); });
+            for (std::size_t i = 0; i < shared_strings.size(); ++i)
+                w.node("si", {}, [&](xl::xw& w) {
+                    w.node("t", {}, [&](xl::xw& w) { w.scramble(shared_strings[i]); });
+                });
         });
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
 inline void writer::write_styles()
@@ -449,77 +1261,35 @@ inline void writer::write_styles()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
-    w.node("styleSheet",
-        {
-            {"xmlns", "http://schemas.openxmlformats.org/spreadsheetml/2006/main"},
-        },
-        [&](xl::xw& w) {
-            if (!cell_xfs.empty()) {
-
-                w.node("fonts", {{"count", "1"}},
-                    [&](xl::xw& w) { w.node("font", {}, [&](xl::xw& w) {}); });
-
-                w.node("fills", {{"count", "1"}}, [&](xl::xw& w) {
-                    w.node("fill", {},
-                        [&](xl::xw& w) { w.node("patternFill", {{"patternType", "none"}}, {}); });
-                });
-
-                w.node("borders", {{"count", "1"}}, [&](xl::xw& w) {
-                    w.node("border", {}, [&](xl::xw& w) {
-                        w.node("left", {}, {});
-                        w.node("right", {}, {});
-                        w.node("top", {}, {});
-                        w.node("bottom", {}, {});
-                        w.node("diagonal", {}, {});
-                    });
-                });
-
-                w.node("cellStyleXfs", {{"count", "1"}}, [&](xl::xw& w) {
-                    w.node("xf",
-                        {
-                            {"numFmtId", "0"},
-                            {"fontId", "0"},
-                            {"fillId", "0"},
-                            {"borderId", "0"},
-                        },
-                        {});
-                });
-
-                auto default_attrs = std::map<std::string, std::string>{
-                    {"numFmtId", "0"},
-                    {"fontId", "0"},
-                    {"fillId", "0"},
-                    {"borderId", "0"},
-                    {"xfId", "0"},
-                };
-
-                w.node("cellXfs", {{"count", std::to_string(cell_xfs.size() + 1)}}, [&](xl::xw& w) {
-                    w.node("xf", default_attrs, {});
-                    for (auto const& xf : cell_xfs) {
-                        auto attrs = default_attrs;
-                        if (!detail::is_empty(xf.alignment)) {
-                            attrs["applyAlignment"] = "1";
-                        }
-
-                        w.node("xf", attrs, [&](xl::xw& w) {
-                            if (!detail::is_empty(xf.alignment)) {
-                                auto aa = std::map<std::string, std::string>{};
-                                if (!xf.alignment.horizontal.empty())
-                                    aa["horizontal"] = xf.alignment.horizontal;
-                                if (!xf.alignment.vertical.empty())
-                                    aa["vertical"] = xf.alignment.vertical;
-                                w.node("alignment", aa, {});
-                            }
-                        });
-                    }
-                });
+    w.put(detail::parts::styles_begin);
+    if (!cell_xfs.empty()) {
+        w.put(detail::parts::styles_skeleton);
+        w.open("cellXfs", {{"count", cell_xfs.size() + 1}});
+        w.put(detail::parts::default_xf);
+        for (auto const& xf : cell_xfs) {
+            if (detail::is_empty(xf.alignment)) {
+                w.put(detail::parts::xf_begin);
+                w.put(detail::parts::xf_end);
+                continue;
             }
-        });
+            auto aa = std::array<xw::attr, 2>{};
+            auto count = std::size_t{0};
+            if (!xf.alignment.horizontal.empty())
+                aa[count++] = {"horizontal", xf.alignment.horizontal};
+            if (!xf.alignment.vertical.empty())
+                aa[count++] = {"vertical", xf.alignment.vertical};
+            w.put(detail::parts::aligned_xf_begin);
+            w.node("alignment", std::span{aa.data(), count});
+            w.put(detail::parts::xf_end);
+        }
+        w.close("cellXfs");
+    }
+    w.put(detail::parts::styles_end);
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
 inline void writer::write_media()
@@ -529,7 +1299,7 @@ inline void writer::write_media()
 
     for (auto const& m : media) {
         auto const fn = std::string{"/xl/media/"} + m.name;
-        files[fn] = std::string{reinterpret_cast<char const*>(m.blob.data()), m.blob.size()};
+        files[fn] = part{m.blob, m.owner}; // refers to the picture bytes, without copying them
         rich_data_rels[m.rid] = rel_info{
             .type = "http://schemas.openxmlformats.org/officeDocument/2006/relationships/image",
             .target = std::string{"../media/"} + m.name,
@@ -551,7 +1321,7 @@ inline void writer::write_metadata()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
     w.node("metadata",
@@ -561,66 +1331,48 @@ inline void writer::write_metadata()
         },
         [&](xl::xw& w) {
             w.node("metadataTypes", {{"count", "1"}}, [](xl::xw& w) {
-                auto attrs = std::map<std::string, std::string>{
-                    {"name", "XLRICHVALUE"},
-                    {"minSupportedVersion", "120000"},
-                    {"copy", "1"},
-                    {"pasteAll", "1"},
-                    {"pasteValues", "1"},
-                    {"merge", "1"},
-                    {"splitFirst", "1"},
-                    {"rowColShift", "1"},
-                    {"clearFormats", "1"},
-                    {"clearComments", "1"},
-                    {"assign", "1"},
-                    {"coerce", "1"},
-
-                };
-
                 w.node("metadataType",
                     {
-                        {"name", "XLRICHVALUE"},
-                        {"minSupportedVersion", "120000"},
+                        {"assign", "1"},
+                        {"clearComments", "1"},
+                        {"clearFormats", "1"},
+                        {"coerce", "1"},
                         {"copy", "1"},
+                        {"merge", "1"},
+                        {"minSupportedVersion", "120000"},
+                        {"name", "XLRICHVALUE"},
                         {"pasteAll", "1"},
                         {"pasteValues", "1"},
-                        {"merge", "1"},
-                        {"splitFirst", "1"},
                         {"rowColShift", "1"},
-                        {"clearFormats", "1"},
-                        {"clearComments", "1"},
-                        {"assign", "1"},
-                        {"coerce", "1"},
-
-                    },
-                    {});
+                        {"splitFirst", "1"},
+                    });
             });
 
-            w.node("futureMetadata",
-                {{"name", "XLRICHVALUE"}, {"count", std::to_string(media.size())}}, [&](xl::xw& w) {
+            w.node("futureMetadata", {{"count", media.size()}, {"name", "XLRICHVALUE"}},
+                [&](xl::xw& w) {
                     for (auto const& m : media)
                         w.node("bk", {}, [&](xl::xw& w) {
                             w.node("extLst", {}, [&](xl::xw& w) {
                                 w.node("ext", {{"uri", "{3e2802c4-a4d2-4d8b-9148-e3be6c30e623}"}},
                                     [&](xl::xw& w) {
-                                        w.node("xlrd:rvb", {{"i", std::to_string(m.iid)}}, {});
+                                        w.node("xlrd:rvb", {{"i", m.iid}});
                                     });
                             });
                         });
                 });
 
-            w.node("valueMetadata", {{"count", std::to_string(media.size())}}, [&](xl::xw& w) {
+            w.node("valueMetadata", {{"count", media.size()}}, [&](xl::xw& w) {
                 for (auto const& m : media)
                     w.node("bk", {}, [&](xl::xw& w) {
-                        w.node("rc", {{"t", "1"}, {"v", std::to_string(m.iid)}}, {});
+                        w.node("rc", {{"t", "1"}, {"v", m.iid}});
                     });
             });
         });
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-void writer::write_rich_value_rel()
+inline void writer::write_rich_value_rel()
 {
     auto rid = rel_id(next_workbook_id());
 
@@ -633,7 +1385,7 @@ void writer::write_rich_value_rel()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
     w.node("richValueRels",
@@ -643,13 +1395,13 @@ void writer::write_rich_value_rel()
         },
         [&](xl::xw& w) {
             for (auto const& m : media)
-                w.node("rel", {{"r:id", m.rid}}, {});
+                w.node("rel", {{"r:id", m.rid}});
         });
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-void writer::write_rich_value_structure()
+inline void writer::write_rich_value_structure()
 {
     auto rid = rel_id(next_workbook_id());
 
@@ -662,25 +1414,25 @@ void writer::write_rich_value_structure()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
     w.node("rvStructures",
         {
-            {"xmlns", "http://schemas.microsoft.com/office/spreadsheetml/2017/richdata"},
             {"count", "1"},
+            {"xmlns", "http://schemas.microsoft.com/office/spreadsheetml/2017/richdata"},
         },
         [&](xl::xw& w) {
             w.node("s", {{"t", "_localImage"}}, [&](xl::xw& w) {
-                w.node("k", {{"n", "_rvRel:LocalImageIdentifier"}, {"t", "i"}}, {});
-                w.node("k", {{"n", "CalcOrigin"}, {"t", "i"}}, {});
+                w.node("k", {{"n", "_rvRel:LocalImageIdentifier"}, {"t", "i"}});
+                w.node("k", {{"n", "CalcOrigin"}, {"t", "i"}});
             });
         });
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-void writer::write_rich_value_data()
+inline void writer::write_rich_value_data()
 {
     auto rid = rel_id(next_workbook_id());
 
@@ -693,13 +1445,13 @@ void writer::write_rich_value_data()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
     w.node("rvData",
         {
+            {"count", media.size()},
             {"xmlns", "http://schemas.microsoft.com/office/spreadsheetml/2017/richdata"},
-            {"count", std::to_string(media.size())},
         },
         [&](xl::xw& w) {
             for (auto const& m : media)
@@ -709,10 +1461,10 @@ void writer::write_rich_value_data()
                 });
         });
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-void writer::write_rich_value_types()
+inline void writer::write_rich_value_types()
 {
     auto rid = rel_id(next_workbook_id());
 
@@ -725,26 +1477,26 @@ void writer::write_rich_value_types()
         .target = relpath,
     };
 
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
     w.node("rvTypesInfo",
         {
+            {"mc:Ignorable", "x"},
             {"xmlns", "http://schemas.microsoft.com/office/spreadsheetml/2017/richdata2"},
             {"xmlns:mc", "http://schemas.openxmlformats.org/markup-compatibility/2006"},
             {"xmlns:x", "http://schemas.openxmlformats.org/spreadsheetml/2006/main"},
-            {"mc:Ignorable", "x"},
         },
         [&](xl::xw& w) {
             w.node("global", {}, [&](xl::xw& w) {
                 w.node("key", {{"name", "_Self"}}, [&](xl::xw& w) {
-                    w.node("flag", {{"name", "ExcludeFromFile"}, {"value", "1"}}, {});
-                    w.node("flag", {{"name", "ExcludeFromCalcComparison"}, {"value", "1"}}, {});
+                    w.node("flag", {{"name", "ExcludeFromFile"}, {"value", "1"}});
+                    w.node("flag", {{"name", "ExcludeFromCalcComparison"}, {"value", "1"}});
                 });
 
                 auto mk_field = [&](std::string const& n) {
                     w.node("key", {{"name", "v"}},
-                        [&](xl::xw& w) { w.node("flag", {{"name", n}, {"value", "1"}}, {}); });
+                        [&](xl::xw& w) { w.node("flag", {{"name", n}, {"value", "1"}}); });
                 };
 
                 mk_field("_DisplayString");
@@ -759,54 +1511,119 @@ void writer::write_rich_value_types()
             });
         });
 
-    files[abspath] = buf;
+    files[abspath] = std::move(buf);
 }
 
-void writer::write_rels(std::string const& path, std::map<std::string, rel_info> const& rels)
+inline void writer::write_rels(
+    std::string const& path, std::map<std::string, rel_info> const& rels)
 {
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
-    w.node("Relationships",
-        {
-            {"xmlns", "http://schemas.openxmlformats.org/package/2006/relationships"},
-        },
-        [&](xl::xw& w) {
-            for (auto const& [rid, info] : rels)
-                w.node("Relationship", {{"Id", rid}, {"Type", info.type}, {"Target", info.target}},
-                    {});
-        });
+    w.put(detail::parts::relationships_begin);
+    for (auto const& [rid, info] : rels)
+        w.node("Relationship", {{"Id", rid}, {"Target", info.target}, {"Type", info.type}});
+    w.put(detail::parts::relationships_end);
 
-    files[path] = buf;
+    files[path] = std::move(buf);
 }
 
-void writer::write_content_types()
+inline void writer::write_content_types()
 {
-    auto buf = std::string{};
+    auto buf = take_buffer();
     auto w = xw{buf};
     w.write_decl();
-    w.node("Types",
-        {
-            {"xmlns", "http://schemas.openxmlformats.org/package/2006/content-types"},
-        },
-        [&](xl::xw& w) {
-            for (auto const& [ext, ctype] : default_content_types)
-                w.node("Default", {{"Extension", ext}, {"ContentType", ctype}}, {});
-            for (auto const& [abspath, ctype] : part_content_types)
-                w.node("Override", {{"PartName", abspath}, {"ContentType", ctype}}, {});
-        });
+    w.put(detail::parts::content_types_begin);
+    for (auto const& [ext, ctype] : default_content_types)
+        w.node("Default", {{"ContentType", ctype}, {"Extension", ext}});
+    for (auto const& [abspath, ctype] : part_content_types)
+        w.node("Override", {{"ContentType", ctype}, {"PartName", abspath}});
+    w.put(detail::parts::content_types_end);
+
+    files["/[Content_Types].xml"] = std::move(buf);
+}
+
+inline auto writer::shared_string(std::string_view v) -> std::size_t
+{
+    if (!stats)
+        return shared_strings.intern(v);
+
+    auto const count = shared_strings.size();
+    auto const i = shared_strings.intern(v);
+    ++(shared_strings.size() > count ? stats->shared_string_misses : stats->shared_string_hits);
+    return i;
+}
 
-    files["/[Content_Types].xml"] = buf;
+// registers a string and returns its index, for cells and columnar sheets that refer to it
+//
+// the index stays valid for the lifetime of the writer
+inline auto writer::string_id(std::string_view v) -> shared_string_id
+{
+    auto const i = shared_string(v);
+    if (i > std::numeric_limits<std::uint32_t>::max())
+        throw std::runtime_error("too many shared strings");
+    return {std::uint32_t(i)};
 }
 
-inline auto writer::shared_string(std::string const& v) -> std::size_t
+// returns the value metadata index (the value of the vm attribute) for a picture, registering
+// the picture as a media part on first use
+//
+// the media part keeps a copy of the bytes of cell_picture::blob, unless borrow is set and the
+// picture outlives packing (see model_tables); shared_blob is never copied
+inline auto writer::picture(cell_picture const& pic, bool borrow) -> std::size_t
 {
-    if (auto it = shared_string_map.find(v); it != shared_string_map.end())
-        return it->second;
-    auto n = shared_strings.size();
-    shared_strings.push_back(v);
-    shared_string_map[v] = n;
-    return n;
+    auto ext = pic.ext;
+    if (ext == ".jpeg" || ext == ".jpg") {
+        ext = ".jpeg";
+        default_content_types["jpeg"] = "image/jpeg";
+    }
+    else if (pic.ext == ".png")
+        default_content_types["png"] = "image/png";
+    else
+        throw std::runtime_error(std::string{"unsupported image extension: "} + pic.ext);
+
+    auto const blob = pic.bytes();
+    auto const hash = fnv64(blob.data(), blob.size());
+    char bb[64];
+    auto [p, _] = std::to_chars(bb, bb + 64, hash, 16);
+    auto n = std::string{bb, p} + ext;
+    if (auto m = media_map.find(n); m != media_map.end())
+        return m->second + 1;
+
+    auto owner = std::shared_ptr<void const>{pic.shared_blob};
+    auto bytes = blob;
+    if (!owner && !borrow) {
+        auto copy = std::make_shared<std::vector<std::byte> const>(blob.begin(), blob.end());
+        bytes = *copy;
+        owner = std::move(copy);
+    }
+
+    auto media_id = next_rich_data_id();
+    auto iid = media.size();
+    media.push_back(media_info{
+        .name = n,
+        .blob = bytes,
+        .owner = std::move(owner),
+        .iid = iid,
+        .rid = rel_id(media_id),
+    });
+    media_map[n] = iid;
+    return iid + 1;
+}
+
+// returns the style index for the given cell format (the value of the s attribute), registering
+// the format on first use; the index of an empty format is 0
+//
+// the returned index can be stored in cell::style, to skip the lookup for every cell
+inline auto writer::style(xl::xf const& v) -> std::size_t
+{
+    if (detail::is_empty(v))
+        return 0;
+
+    auto [it, inserted] = cell_xf_map.try_emplace(v, cell_xfs.size() + 1);
+    if (inserted)
+        cell_xfs.push_back(v);
+    return it->second;
 }
 
 inline auto writer::next_global_id() -> int
@@ -1,20 +1,95 @@
 #pragma once
 
+#include <bit>
+#include <concepts>
 #include <functional>
+#include <initializer_list>
 #include <map>
+#include <span>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <xl/format.hpp>
+
+#if !defined(XL_NO_SIMD)
+#if defined(__AVX2__)
+#define XL_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XL_SSE2 1
+#include <emmintrin.h>
+#endif
+#endif
 
 namespace xl {
 
 struct xw {
+    struct attr;
+
     std::string& buffer;
     void put(std::string_view raw);
+    void open(std::string_view tag, std::initializer_list<attr> attrs = {});
+    void open(std::string_view tag, std::span<attr const> attrs);
+    void close(std::string_view tag);
+    void put_attrs(std::span<attr const> attrs);
+    void node(std::string_view tag, std::initializer_list<attr> attrs = {});
+    void node(std::string_view tag, std::span<attr const> attrs);
+    template <std::invocable<xw&> F>
+    void node(std::string_view tag, std::initializer_list<attr> attrs, F&& content);
+    template <std::invocable<xw&> F>
+    void node(std::string_view tag, std::span<attr const> attrs, F&& content);
+    void open(std::string_view tag, std::map<std::string, std::string> const& attrs);
+    void put_attrs(std::map<std::string, std::string> const& attrs);
     void node(std::string_view tag, std::map<std::string, std::string> const& attrs,
         std::function<void(xw& w)>&& content);
     void scramble(std::string_view s, bool in_otag = true);
     void write_decl();
 };
 
+// element attribute
+//
+// attributes do not own string values, those must outlive the node call; integer values and cell
+// references are formatted into the attribute itself, so that no allocation is involved either way
+struct xw::attr {
+    std::string_view name;
+
+    attr() = default;
+
+    attr(std::string_view name, std::string_view value)
+        : name{name}
+        , str{value}
+    {
+    }
+
+    template <std::integral T>
+        requires(!std::same_as<T, bool>)
+    attr(std::string_view name, T value)
+        : name{name}
+    {
+        if constexpr (std::is_signed_v<T>)
+            num_size = std::size_t(format_int(num, std::int64_t(value)) - num);
+        else
+            num_size = std::size_t(format_uint(num, std::uint64_t(value)) - num);
+    }
+
+    attr(std::string_view name, cell_ref ref)
+        : name{name}
+    {
+        num_size = std::size_t(format_cell_ref(num, ref) - num);
+    }
+
+    auto value() const -> std::string_view
+    {
+        return num_size ? std::string_view{num, num_size} : str;
+    }
+
+private:
+    std::string_view str;
+    char num[24] = {};
+    std::size_t num_size = 0;
+};
+
 inline void xw::put(std::string_view raw) { buffer += raw; }
 
 inline void xw::write_decl()
@@ -22,11 +97,81 @@ inline void xw::write_decl()
     put("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n");
 }
 
-inline void xw::node(std::string_view tag, std::map<std::string, std::string> const& attrs,
-    std::function<void(xw& w)>&& content)
+// writes the opening tag of an element whose content is emitted separately, must be paired with
+// a matching close()
+inline void xw::open(std::string_view tag, std::initializer_list<attr> attrs)
+{
+    open(tag, std::span{attrs.begin(), attrs.size()});
+}
+
+inline void xw::open(std::string_view tag, std::span<attr const> attrs)
+{
+    put("<");
+    put(tag);
+    put_attrs(attrs);
+    put(">");
+}
+
+inline void xw::close(std::string_view tag)
+{
+    put("</");
+    put(tag);
+    put(">");
+}
+
+inline void xw::put_attrs(std::span<attr const> attrs)
+{
+    for (auto const& a : attrs) {
+        put(" ");
+        put(a.name);
+        put("=\"");
+        scramble(a.value(), true);
+        put("\"");
+    }
+}
+
+// writes an empty element
+inline void xw::node(std::string_view tag, std::initializer_list<attr> attrs)
+{
+    node(tag, std::span{attrs.begin(), attrs.size()});
+}
+
+inline void xw::node(std::string_view tag, std::span<attr const> attrs)
 {
     put("<");
     put(tag);
+    put_attrs(attrs);
+    put("/>");
+}
+
+// writes an element with the content produced by calling content(*this)
+template <std::invocable<xw&> F>
+inline void xw::node(std::string_view tag, std::initializer_list<attr> attrs, F&& content)
+{
+    node(tag, std::span{attrs.begin(), attrs.size()}, std::forward<F>(content));
+}
+
+template <std::invocable<xw&> F>
+inline void xw::node(std::string_view tag, std::span<attr const> attrs, F&& content)
+{
+    open(tag, attrs);
+    std::invoke(std::forward<F>(content), *this);
+    close(tag);
+}
+
+// overloads taking attributes as a map (written in key order) and the content as a std::function
+// (an empty one writing an empty element), kept for existing callers; they are slower than the
+// ones above, which allocate neither
+inline void xw::open(std::string_view tag, std::map<std::string, std::string> const& attrs)
+{
+    put("<");
+    put(tag);
+    put_attrs(attrs);
+    put(">");
+}
+
+inline void xw::put_attrs(std::map<std::string, std::string> const& attrs)
+{
     for (auto const& [k, v] : attrs) {
         put(" ");
         put(k);
@@ -34,18 +179,81 @@ inline void xw::node(std::string_view tag, std::map<std::string, std::string> co
         scramble(v, true);
         put("\"");
     }
+}
+
+inline void xw::node(std::string_view tag, std::map<std::string, std::string> const& attrs,
+    std::function<void(xw& w)>&& content)
+{
     if (content) {
-        put(">");
+        open(tag, attrs);
         content(*this);
-        put("</");
-        put(tag);
-        put(">");
+        close(tag);
     }
     else {
+        put("<");
+        put(tag);
+        put_attrs(attrs);
         put("/>");
     }
 }
 
+namespace detail {
+
+// characters that scramble may have to replace: markup characters, quotes and control characters
+inline auto is_xml_special(char c) -> bool
+{
+    return static_cast<unsigned char>(c) < 0x20 || c == '&' || c == '<' || c == '>' || c == '"' ||
+           c == '\'';
+}
+
+inline auto find_xml_special_scalar(char const* p, char const* end) -> char const*
+{
+    while (p != end && !is_xml_special(*p))
+        ++p;
+    return p;
+}
+
+// returns the first character in [p, end) for which is_xml_special is true, or end
+//
+// skips clean blocks of 32 (AVX2) or 16 (SSE2) bytes at a time, most of the text written into
+// the sheets has nothing to escape at all
+inline auto find_xml_special(char const* p, char const* end) -> char const*
+{
+#if defined(XL_AVX2)
+    while (end - p >= 32) {
+        auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+        auto const ctl = _mm256_set1_epi8(0x1f);
+        auto m = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+        if (auto const mask = unsigned(_mm256_movemask_epi8(m)))
+            return p + std::countr_zero(mask);
+        p += 32;
+    }
+#endif
+#if defined(XL_SSE2)
+    while (end - p >= 16) {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+        auto const ctl = _mm_set1_epi8(0x1f);
+        auto m = _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+        if (auto const mask = unsigned(_mm_movemask_epi8(m)))
+            return p + std::countr_zero(mask);
+        p += 16;
+    }
+#endif
+    return find_xml_special_scalar(p, end);
+}
+
+} // namespace detail
+
 inline void xw::scramble(std::string_view s, bool in_otag)
 {
     if (s.empty())
@@ -63,6 +271,10 @@ inline void xw::scramble(std::string_view s, bool in_otag)
     };
 
     while (cursor != end) {
+        cursor = detail::find_xml_special(cursor, end);
+        if (cursor == end)
+            break;
+
         auto cp = *cursor;
         if (!in_otag && (cp == '\r' || cp == '\n')) {
             auto rn = cp == '\r' && cursor + 1 != end && cursor[1] == '\n';